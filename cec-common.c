@@ -78,7 +78,7 @@ struct Shelf *cec_probe(int waitsecs,int shelf,char *shelfea) {
   q.len = 0;
   q.conn = 0;
   q.seq = 0;
-  netsend(&q, 60);
+  netsendif(NETIF_ALL, &q, 60);
   timewait(waitsecs);
 
   /* Wait for packets */
@@ -116,7 +116,8 @@ struct Shelf *cec_probe(int waitsecs,int shelf,char *shelfea) {
       sh = strtok((char *)q.data, " \t");
       if (sh == NULL)
 	continue;
-      if (shelf != -1 && (n=atoi(sh)) != shelf)
+      n = atoi(sh);
+      if (shelf != -1 && n != shelf)
 	continue;
       if (shelfea && memcmp(shelfea, q.src, 6))
 	continue;
@@ -130,6 +131,7 @@ struct Shelf *cec_probe(int waitsecs,int shelf,char *shelfea) {
       r = s;
 
       memcpy(s->ea, q.src, 6);
+      s->ifn = netifn;
       s->shelfno = n;
       s->str = other && other[0] ? strdup(other) : "";
       if (!s->str) s->str = "";
@@ -145,7 +147,7 @@ struct Shelf *cec_probe(int waitsecs,int shelf,char *shelfea) {
   return r;
 }
 
-int cec_Treset(uchar *ea,int conn) {
+int cec_Treset(int ifn,uchar *ea,int conn) {
   struct Pkt q;
   memset(q.src,0,6);
   memcpy(q.dst,ea,6);
@@ -154,10 +156,10 @@ int cec_Treset(uchar *ea,int conn) {
   q.len = 0;
   q.conn = conn;
   q.seq = 0;
-  return netsend(&q,60);
+  return netsendif(ifn,&q,60);
 }
 
-int cec_Tdata(uchar *ea,int conn,int seq,char *str) {
+int cec_Tdata(int ifn,uchar *ea,int conn,int seq,char *str) {
   struct Pkt q;
   memset(q.src,0,6);
   memcpy(q.dst,ea,6);
@@ -167,5 +169,5 @@ int cec_Tdata(uchar *ea,int conn,int seq,char *str) {
   q.conn = conn;
   q.len = strlen(str);
   strcpy((char *)q.data,str);
-  return netsend(&q,HDRSIZ+q.len);
+  return netsendif(ifn,&q,HDRSIZ+q.len);
 }
@@ -49,6 +49,9 @@
  * separated list as follows.  If no servers are discovered,
  * cec exits.
  *
+ * Several interfaces may be probed at once by giving a comma
+ * separated list (e.g., "eth0,eth1").
+ *
  *    :  SHELF | EA
  *    :  5       003048865F1E,003048865F1F
  *    :  [#qp]: 
@@ -71,9 +74,18 @@
  * Once connected to a cec server, entering the escape sequence
  * will drop the user into an escape prompt where the user may
  * type 'q' to quit the connection, 'i' to send the escape sequence
- * across the connection, or '.' to continue the connection.
+ * across the connection, 'h' to look at the console history or
+ * '.' to continue the connection.
  * The escape sequence is printed on connection.
  *
+ * After 'h', *cec* asks what to show.  This can be the last
+ * lines (e.g., "200l") or bytes ("4096b", "64k"), or the output
+ * since a given time, either relative ("-10m", "-2h", "-1d") or
+ * absolute ("14:30", "2026-10-18 14:30:00").  Two times separated by a
+ * comma select a range.  The server sends the requested output
+ * and then continues with the live session.  Only servers that keep
+ * history (see *ec-drv(8)*) support this.
+ *
  * == OPTIONS
  *
  * * *-d*::
@@ -136,6 +148,7 @@
 #include <sys/errno.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <time.h>
 #include "cec.h"
 
 #define	nelem(x)	(sizeof(x)/sizeof((x)[0]))
@@ -167,13 +180,13 @@ int	pflag;
 int	qflag;
 char	shelfea[6];
 int	waitsecs = WAITSECS;
+char	histreq[64];
 
 #ifndef VERSION
 #define VERSION "0.00"
 #endif
 int debug = 0;
 char *progname = "cec";
-extern int netfd;	/* set in netopen */
 
 void
 usage(void)
@@ -300,7 +313,7 @@ probe(void)
 	q.len = 0;
 	q.conn = 0;
 	q.seq = 0;
-	netsend(&q, 60);
+	netsendif(NETIF_ALL, &q, 60);
 	vprintf("Probing for shelves ... ");
 	fflush(stderr);
 	timewait(waitsecs);
@@ -333,6 +346,7 @@ probe(void)
 				continue;
 			other = strtok(NULL, "\x1");
 			memcpy(s.ea, q.src, 6);
+			s.ifn = netifn;
 			s.shelfno = atoi(sh);
 			s.str = other ? strdup(other) : "";
 			shinsert(&s);
@@ -457,7 +471,7 @@ ethclose(void)
 	
 	sethdr(&msg, Treset);
 	timewait(waitsecs);
-	netsend(&msg, 60);
+	netsendif(connp->ifn, &msg, 60);
 	alarm(0);
 	connp = 0;
 }
@@ -469,7 +483,7 @@ cecconnect(void)
 	int cnt, n;
 
 	sethdr(&pk, Tinita);
-	netsend(&pk, 60);
+	netsendif(connp->ifn, &pk, 60);
 	
 	/*  wait for INITB */
 	
@@ -486,7 +500,7 @@ cecconnect(void)
 			if (n < 0 && errno == EINTR) {
 				if (--cnt > 0) {
 					timewait(waitsecs);
-					netsend(&pk, 60);
+					netsendif(connp->ifn, &pk, 60);
 				} else {
 					alarm(0);
 					return 0;
@@ -497,7 +511,7 @@ cecconnect(void)
 	
 	alarm(0);	
 	sethdr(&pk, Tinitc);
-	netsend(&pk, 60);
+	netsendif(connp->ifn, &pk, 60);
 	return 1;
 }
 
@@ -545,6 +559,84 @@ readln(int fd, char *buf, int len)
 	return n;
 }
 
+/*
+ * Convert a time given as -N[smhd], HH:MM[:SS] or
+ * YYYY-MM-DD HH:MM[:SS] into unix time.
+ */
+long
+histtime(char *s)
+{
+	struct tm tm;
+	time_t now;
+	long n;
+	char u;
+
+	now = time(nil);
+	while (*s == ' ')
+		s++;
+	if (*s == '-') {
+		u = 's';
+		if (sscanf(s+1, "%ld%c", &n, &u) < 1 || n < 0)
+			return -1;
+		switch (u) {
+		case 'd': n *= 24;
+		case 'h': n *= 60;
+		case 'm': n *= 60;
+		case 's': break;
+		default: return -1;
+		}
+		return now - n;
+	}
+	tm = *localtime(&now);
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	if (sscanf(s, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon,
+	    &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) >= 5) {
+		tm.tm_year -= 1900;
+		tm.tm_mon--;
+		return mktime(&tm);
+	}
+	if (sscanf(s, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) >= 2) {
+		n = mktime(&tm);
+		return n > now ? n - 24*60*60 : n;	/* yesterday */
+	}
+	return -1;
+}
+
+/*
+ * Parse what the user wants to see into a Thistory request:
+ *	Nl		last N lines
+ *	Nb, Nk		last N bytes or kbytes
+ *	when[,when]	output between two times (see histtime)
+ */
+int
+histparse(char *s, char *req, int len)
+{
+	long n, from, to;
+	char u, *p;
+
+	if (sscanf(s, "%ld%c", &n, &u) == 2 && n > 0)
+		switch (u) {
+		case 'l':
+			return snprintf(req, len, "l %ld", n);
+		case 'k':
+			n *= 1024;
+		case 'b':
+			return snprintf(req, len, "b %ld", n);
+		}
+	to = -1;
+	if ((p = strchr(s, ',')) != nil) {
+		*p++ = 0;
+		if ((to = histtime(p)) == -1)
+			return 0;
+	}
+	if ((from = histtime(s)) == -1)
+		return 0;
+	if (to != -1)
+		return snprintf(req, len, "t %ld %ld", from, to);
+	return snprintf(req, len, "t %ld", from);
+}
+
 char
 escape(void)
 {
@@ -562,8 +654,22 @@ loop:
 	case 'q':
 	case '.':
 		return c;
+	case 'h':
+		fprintf(stderr, "history [200l]: ");
+		n = readln(0, buf, sizeof buf - 1);
+		if (n <= 0)
+			return '.';
+		buf[n] = 0;
+		buf[strcspn(buf, "\r\n")] = 0;
+		if (buf[0] == 0)
+			strcpy(buf, "200l");
+		if (histparse(buf, histreq, sizeof histreq) > 0)
+			return c;
+		fprintf(stderr, "	Nl, Nb, Nk, -N[smhd], HH:MM[:SS] or "
+		    "YYYY-MM-DD HH:MM[:SS], a range as from,to\r\n");
+		goto loop;
 	}
-	fprintf(stderr, "	(q)uit, (i)nterrupt, (.)continue\r\n");
+	fprintf(stderr, "	(q)uit, (i)nterrupt, (h)istory, (.)continue\r\n");
 	goto loop;
 }
 
@@ -572,7 +678,7 @@ doloop(void)
 {
 	fd_set rfds;
 	char c;
-	int n, unacked = 0, retries;
+	int n, maxfd, unacked = 0, retries;
 	uchar sndseq = 0, rcvseq = -1;
 	Pkt sndpkt, rcvpkt;
 	uchar ea[6];
@@ -581,7 +687,7 @@ doloop(void)
 	memmove(ea, connp->ea, 6);
 	for (;;) {
 		FD_ZERO(&rfds);
-		FD_SET(netfd, &rfds);
+		maxfd = netfds(&rfds, 0);
 		if (unacked == 0)
 			FD_SET(0, &rfds);
 		if (unacked) {
@@ -590,7 +696,7 @@ doloop(void)
 			tvp->tv_usec = 0;
 		} else
 			tvp = NULL;
-		n = select(netfd+1, &rfds, nil, nil, tvp);
+		n = select(maxfd+1, &rfds, nil, nil, tvp);
 		if (n < 0) {
 			perror("select failed");
 			exits("select");
@@ -600,7 +706,8 @@ doloop(void)
 				fprintf(stderr, "Connection timed out\r\n");
 				return;
 			}
-			netsend(&sndpkt, HDRSIZ + n < 60 ? 60 : HDRSIZ + n);
+			n = sndpkt.len;
+			netsendif(connp->ifn, &sndpkt, HDRSIZ + n < 60 ? 60 : HDRSIZ + n);
 			continue;
 		}
 		if (FD_ISSET(0, &rfds)) {
@@ -615,22 +722,27 @@ doloop(void)
 				case 'q':
 					sndpkt.len = 0;
 					sndpkt.type = Treset;
-					netsend(&sndpkt, 60);
+					netsendif(connp->ifn, &sndpkt, 60);
 					return;
 				case '.':
 					continue;
+				case 'h':
+					sethdr(&sndpkt, Thistory);
+					n = strlen(histreq);
+					memmove(sndpkt.data, histreq, n);
+					goto send;
 				case 'i':
 					break;
 				}
 			}
 			sndpkt.data[0] = c;
+		send:
 			sndpkt.len = n;
 			sndpkt.seq = ++sndseq;
 			unacked = 1;
 			retries = 3;
-			netsend(&sndpkt, HDRSIZ + n < 60 ? 60 : HDRSIZ + n);
-		} else if (FD_ISSET(netfd, &rfds)) {
-			n = netrecv();
+			netsendif(connp->ifn, &sndpkt, HDRSIZ + n < 60 ? 60 : HDRSIZ + n);
+		} else if ((n = netrecvset(&rfds)) != 0) {
 			if (n < 0) {
 				perror("netread failed");
 				exits("netread");
@@ -640,6 +752,8 @@ doloop(void)
 					continue;
 				if (memcmp(rcvpkt.src, ea, 6) != 0)
 					continue;
+				if (netifn != connp->ifn)
+					continue;
 				if (ntohs(rcvpkt.etype) != CEC_ETYPE)
 					continue;
 				switch (rcvpkt.type) {
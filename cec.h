@@ -20,9 +20,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <sys/select.h>
+
 typedef unsigned char uchar;
 typedef unsigned short ushort;
 typedef unsigned int uint;
+typedef unsigned long long offset_t;	/* position in a console stream */
 
 enum {
 	Tinita = 0,
@@ -33,6 +36,7 @@ enum {
 	Tdiscover,
 	Toffer,
 	Treset,
+	Thistory,	// LEC extension: replay console history
 	
 	HDRSIZ = 18,
 	WAITSECS= 2,	// seconds to wait for various ops (probe, connection, etc)
@@ -40,6 +44,9 @@ enum {
 	CEC_ETYPE = 0xBCBC,
 	Ntab = 1000,
 	MAX_PAYLOAD = 255,
+
+	MAX_NETIFS = 8,	// interfaces a single process can serve
+	NETIF_ALL = -1,	// netsendif: send on every interface
 };
 
 /*
@@ -58,16 +65,36 @@ struct Pkt {
 
 struct Shelf {
   char	ea[6];
+  int	ifn;		/* interface it was found on */
   int	shelfno;
   char	*str;
   struct Shelf *next;
 };
 
 /* For sysdep */
+struct Netif {
+  char	name[128];	/* ifname, or vnet:PATH for a vhub socket */
+  int	fd;
+  int	vnet;
+  int	index;
+  char	addr[6];
+  char	*ucast;		/* extra unicast addresses (see netaddmac) */
+  int	nucast;
+};
+extern struct Netif netifs[MAX_NETIFS];
+extern int nnetifs;
+extern int netifn;
+
 int netopen(char *name);
+int netreopen(int ifn);
 int netclose(void);
+int netfds(fd_set *, int);
 int netsend(void *, int);
+int netsendif(int, void *, int);
+int netsendas(int, char *, void *, int);
+int netaddmac(int, char *);
 int netrecv(void);
+int netrecvset(fd_set *);
 int netget(void *, int);
 int netup(char *);
 void rawon(void);
@@ -80,6 +107,7 @@ enum { FQUOTE = (1<<0), FEMPTY = (1<<1) };
 int getfields(char *, char **, int, char *, int);
 char *htoa(char *, char *, uint);
 int parseether(char *, char *);
+long long parsesize(char *);
 
 #define tokenize(A, B, C) getfields((A), (B), (C), " \t\r\n", FQUOTE)
 void fatal(char *);
@@ -88,5 +116,29 @@ void fatal(char *);
 void timewait(int);
 void freeprobe(struct Shelf *s);
 struct Shelf *cec_probe(int waitsecs,int shelf,char *shelfea);
-int cec_Treset(uchar *ea,int conn);
-int cec_Tdata(uchar *ea,int conn,int seq,char *str);
+int cec_Treset(int ifn,uchar *ea,int conn);
+int cec_Tdata(int ifn,uchar *ea,int conn,int seq,char *str);
+
+/* vnet.c */
+struct vhub_stats {
+  unsigned long frames_in, frames_out, drops;
+};
+extern struct vhub_stats vhub_stats;
+int vhub_open(char *path);
+int vhub_input(int fd);
+
+/* ec-log.c */
+void *log_alloc(unsigned long len);
+void log_init(char *dir, offset_t segsz, int keep, int compress);
+offset_t log_stream(char *name, char *ring, unsigned long ringsz);
+void log_start(void);
+void log_update(int n, offset_t head);
+int log_read(int n, offset_t off, char *buf, int len);
+offset_t log_oldest(offset_t head);
+int log_idxopen(char *name);
+
+struct logidx {		/* time index entry */
+  long long t;
+  offset_t off;
+};
+
@@ -48,18 +48,44 @@
  * If no command was specifed, it will simply forward all stdio
  * to incoming client sessions.
  *
+ * _eth_ may be a comma separated list of interfaces (e.g. _eth0,eth1_).
+ * Discovery requests are answered on all of them and each client
+ * session is kept on the interface it connected from.
+ *
+ * Each client receives output at its own pace, one acknowledged frame
+ * at a time, so a client on a slow or lossy link does not hold up the
+ * others.  A client that falls more than *-q* bytes behind is moved
+ * forward to recent output and told how many bytes it missed, which
+ * it can still get with a history request.
+ *
  * == OPTIONS
  *
  * * *-d*::
  *   The -d flag causes *ec-drv* to output copious debugging information.
  *   Only for the strong of heart.
+ * * *-H* _size_::
+ *   Limit on how much output a single history request returns.
+ *   Defaults to 1m.
  * * *-i* _secs_::
  *   Disconnect sesions that have been inactive for more than _secs_
  *   seconds.
  * * *-l*::
  *   Enable local mode.  The run command can be used interactively.
+ * * *-K* _count_::
+ *   Only keep the last _count_ log segments of each console.
+ * * *-L* _dir_::
+ *   Log all console output to segment files in _dir_ (see *LOGGING*).
+ * * *-q* _size_::
+ *   How far a client may fall behind the console output before it is
+ *   moved forward to recent output.  Defaults to 64k.
+ * * *-r* _replay_::
+ *   How much scrollback to send to a newly attached client.  Either a
+ *   number of bytes (with optional _k_ or _m_ suffix) or a number of
+ *   lines followed by _l_ (e.g. _500l_).  Defaults to 200 lines.
  * * *-s* _shelf_::
  *   Assign the _shelf_ number to this *ec-drv* instance.
+ * * *-S* _size_::
+ *   Size of each log segment.  Defaults to 16m.
  * * *-v*::
  *   Print version and exit.
  * * *-w* _secs_::
@@ -67,31 +93,84 @@
  *   timeout.  This timeout defaults to 2, and governs how long to wait 
  *   on probe, connection, and communication timeout.  It must be greater
  *   than 0.
+ * * *-b* _size_::
+ *   Size of the scrollback buffer kept for each console.  Accepts
+ *   _k_ and _m_ suffixes and is rounded up to a power of two.
+ *   Defaults to 256k.
+ * * *-c* _conf_::
+ *   Concentrator mode.  Serve every console listed in _conf_ from
+ *   this one process (see *CONCENTRATOR MODE* below).  No command may
+ *   be given on the command line.
  * * *-f* _output_::
  *   When a USR1 signal is received, will write its shelfno and 
- *   srcaddr to _output_ file.
+ *   srcaddr to _output_ file.  One line is written per interface
+ *   and console.
+ * * *-z*::
+ *   Compress log segments with *gzip* once they are full.
  * * *--*::
  *   Use this to signal the end of *ec-drv* options and start of 
  *   command line.
  *
+ * == CONCENTRATOR MODE
+ *
+ * With *-c* a single *ec-drv* serves many consoles (for example all
+ * the ports of a serial concentrator), each with its own shelf
+ * number, clients and history.  The configuration file has one line
+ * per console:
+ *
+ *    :  # shelf  console
+ *    :  10       /dev/ttyS0 115200
+ *    :  11       /dev/ttyS1
+ *    :  -        |/usr/bin/some-command args
+ *
+ * The shelf may be *-* to pick a free one.  A console given as an
+ * absolute path is a tty device with an optional speed, one starting
+ * with *|* is a command run through _/bin/sh -c_.
+ *
+ * The first console answers on the interface address, the others on
+ * locally administered addresses derived from it, so unmodified *cec*
+ * clients can tell them apart.
+ *
+ * == LOGGING
+ *
+ * With *-L* everything read from a console is also written to disk,
+ * by a separate writer process so that the server never waits on
+ * the disk.  Each console gets a series of segment files
+ * _shelfN.NNNNNN.log_, each holding _size_ bytes (see *-S*) of
+ * output.  Segments are plain files that can be read with the usual
+ * tools (e.g. *tail -f*) while they are being written.  If the writer
+ * ever falls further behind than the scrollback buffer, the lost
+ * output is left as a hole of NUL bytes.
+ *
+ * When restarted, *ec-drv* continues after the last segment found.
+ *
+ * == HISTORY
+ *
+ * *ec-drv* keeps a sparse index of when output was written (saved as
+ * _shelfN.idx_ next to the log segments).  Clients may ask for output
+ * written since a given time, or for the last so many lines or bytes,
+ * with a _Thistory_ request (see the *h* escape command in *cec*).
+ * The reply is streamed from the scrollback or the log, limited by
+ * *-H*, and then the client continues with the live output.
+ *
  * == SEE ALSO
  *
  * *cec(8)*
  *--
  */
 #include "cec.h"
+#include "ec-srv.h"
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
-#include <arpa/inet.h>
-#include <sys/utsname.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <termios.h>
 #include <sys/wait.h>
 
 
@@ -99,410 +178,234 @@
 #define VERSION "0.00"
 #endif
 
-enum {
-  MAX_CLIENTS = 4,	/* We are not too ambitious */
-  IDLE_TIMER = 300,	/* We clear clients after this many seconds */
-};
-
-struct client_t {
-  uchar addr[6];
-  time_t last;
-  uchar conn;
-  uchar seq;
-};
-
-extern int netfd;
-int ifd, ofd;	/* Input/output fd */
-struct client_t clients[MAX_CLIENTS];
-
 int debug = 0;
 int shelf= -1;
-int lconsole = 0;
-int waitsecs = WAITSECS;
-int idle_timer = IDLE_TIMER;
 
 char *progname = "ec-drv";
 char *outfile = NULL;
-
-char ring_buffer[MAX_PAYLOAD];
-unsigned long ring_ptr = 0;
-
-#define TRC { fprintf(stderr,"TRC: %s,%d\r\n",__func__,__LINE__); }
+char *conffile = NULL;
 
 /*
- * Init PTY
+ * Spawn a command with its stdio connected to the console
  */
-pid_t init_fds(void) {
-  pid_t pid;
-  int fd0[2], fd1[2],i;
+void con_spawn(struct console *con, char **argv) {
+  int fd0[2], fd1[2];
   
   if (pipe(fd0) == -1) fatal("pipe0");
   if (pipe(fd1) == -1) fatal("pipe1");
 
-  if ((pid = fork()) == -1) {
+  if ((con->pid = fork()) == -1) {
     //TRC;
     fatal("fork");
   }
-  if (pid) {
+  if (con->pid) {
     /* This is the CEC driver... */
-    ifd = fd1[0]; close(fd1[1]);
-    ofd = fd0[1]; close(fd0[0]);
-    return 0;
-  } else {
-    /* This is the child process */
-    dup2(fd0[0],STDIN_FILENO);
-    dup2(fd1[1],STDOUT_FILENO);
-    dup2(fd1[1],STDERR_FILENO);
-    for (i=0;i<2;i++) {
-      close(fd0[i]);
-      close(fd0[i]);
-    }
-    return 1;
-  }
-}
-
-void ifd_data(void) {
-  struct Pkt q;
-  int i, c;
-
-  c = read(ifd,q.data,MAX_PAYLOAD);
-  if (c == -1) {
-    if (errno == EINTR) return;
-    rawoff();
-    //TRC;
-    fatal("read");
-  }
-
-  if (c==0) {
-    /* Ooops ... EOF */
-    for (i=0;i < MAX_CLIENTS;i++) {
-      if (clients[i].last) {
-	cec_Tdata(clients[i].addr,clients[i].conn,++clients[i].seq,
-		  "[System shutdown]");
-	cec_Treset(clients[i].addr,clients[i].conn);
-      }
-    }
-    fputs("[EOF]\r\n",stderr);
-    rawoff();
-    exit(1);
+    con->ifd = fd1[0]; close(fd1[1]);
+    con->ofd = fd0[1]; close(fd0[0]);
+    fcntl(con->ifd,F_SETFD,FD_CLOEXEC);
+    fcntl(con->ofd,F_SETFD,FD_CLOEXEC);
+    return;
   }
 
-  if (debug || lconsole) write(STDERR_FILENO,q.data,c);
-  /*
-   * Save output to ring buffer
-   */
-  if (((ring_ptr % sizeof(ring_buffer))+c) > sizeof(ring_buffer)) {
-    /* OK, this wraps around... */
-    int l = sizeof(ring_buffer) - (ring_ptr % sizeof(ring_buffer));
-    memcpy(ring_buffer+(ring_ptr % sizeof(ring_buffer)),q.data,l);
-    memcpy(ring_buffer,q.data+l,c-l);
-  } else {
-    /* This is the trivial case... */
-    memcpy(ring_buffer+(ring_ptr % sizeof(ring_buffer)),q.data,c);
-  } 
-  ring_ptr += c;
-  if (ring_ptr > sizeof(ring_buffer)) 
-    ring_ptr = sizeof(ring_buffer) + (ring_ptr % sizeof(ring_buffer));
-
-  q.etype = ntohs(CEC_ETYPE);
-  q.type = Tdata;
-  q.len = c;
-
-  for (i=0;i<MAX_CLIENTS;i++) {
-    if (!clients[i].last) continue;
-
-    q.conn = clients[i].conn;
-    q.seq = ++clients[i].seq;
-
-    memcpy(q.dst,clients[i].addr,6);
-    netsend(&q,HDRSIZ+q.len);
-  }
+  /* This is the child process */
+  dup2(fd0[0],STDIN_FILENO);
+  dup2(fd1[1],STDOUT_FILENO);
+  dup2(fd1[1],STDERR_FILENO);
+  close(fd0[0]); close(fd0[1]);
+  close(fd1[0]); close(fd1[1]);
+  netclose();
+  execvp(argv[0],argv);
+  //TRC;
+  fatal("exec");
 }
 
-int find_client(struct Pkt *p) {
+/*
+ * Open a serial port as the console
+ */
+void con_tty(struct console *con, char *dev, int speed) {
+  static const struct { int bps; speed_t code; } speeds[] = {
+    { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 0, 0 }
+  };
+  struct termios t;
   int i;
-  for (i=0;i< MAX_CLIENTS;i++) {
-    if (clients[i].last 
-	&& memcmp(clients[i].addr,p->src,6) == 0 
-	&& clients[i].conn == p->conn) 
-      return i;
-  }
-  return -1;
-}
 
-void net_data(void) {
-  struct Pkt q;
-  int n;
-
-  if ((n = netget(&q,sizeof q)) > 0) {
-    if (n < 60) return;
-    if (ntohs(q.etype) != CEC_ETYPE) return;
-    memcpy(q.dst,q.src,6);
-
-    switch (q.type) {
-    case Tinita:
-      /* We always say yes... */
-      q.type = Tinitb;
-      netsend(&q,60);
-      break;
-    case Tinitc:
-      n = find_client(&q);
-      if (n != -1) {
-	/* Already connected */
-	cec_Tdata(q.src,q.conn,++clients[n].seq,"[Connected]\n\n");
-	break;
-      }
-
-      for (n=0;n<MAX_CLIENTS;n++)
-	if (!clients[n].last) break;
-	
-      if (n == MAX_CLIENTS) {
-	q.type = Treset;
-	strcpy((char *)q.data,"no free ports");
-      } else {
-	int i;
-	char msg[MAX_PAYLOAD];
-	char aea[16];
-	htoa(aea,(char *)q.src,6);
-	snprintf(msg,MAX_PAYLOAD,"\r\n[New console %d attached (%s-%d)]\r\n",
-		 n,aea,q.conn);
-
-	if (debug || lconsole) fputs(msg,stderr);
-
-	for (i=0; i<MAX_CLIENTS;i++) {
-	  if (clients[i].last) {
-	    cec_Tdata(clients[i].addr,clients[i].conn,++clients[i].seq,msg);
-	  }
-	}
-	clients[n].last = time(NULL);
-	memcpy(clients[n].addr,q.src,6);
-	clients[n].conn = q.conn;
-	clients[n].seq = q.seq;
-
-	/*
-	 * Send the ring buffer...
-	 */
-	q.type = Tdata;
-	strcpy((char *)q.data,"[Connected]\r\n");
-	q.len = strlen((char *)q.data);
-	if (ring_ptr > sizeof(ring_buffer)) {
-	  /* Wrapped around.... */
-	  int addsz = MAX_PAYLOAD - q.len;
-	  int s=(ring_ptr + sizeof(ring_buffer) - addsz) % sizeof(ring_buffer);
-	  int l=sizeof(ring_buffer) - s;
-	  memcpy(q.data + q.len, ring_buffer+s, l);
-	  q.len += l;
-	  l = ring_ptr % sizeof(ring_buffer);
-	  memcpy(q.data + q.len, ring_buffer, l);
-	  q.len += l;
-	} else if (ring_ptr) {
-	  int addsz = ring_ptr + q.len > MAX_PAYLOAD ? 
-	    MAX_PAYLOAD - q.len :
-	    ring_ptr;
-	  memcpy(q.data + q.len, ring_buffer,addsz);
-	  q.len += addsz;
-	}
-      }
-      netsend(&q,HDRSIZ + q.len);
-      break;
-    case Tdata:
-      n = find_client(&q);
-      if (n == -1) {
-	q.type = Treset;
-	strcpy((char *)q.data,"connection closed");
-	q.len = strlen((char *)q.data);
-	netsend(&q,HDRSIZ + q.len);	
-      } else {
-	clients[n].last = time(NULL);
-	write(ofd,q.data,q.len);
-	q.len = 0;
-	q.type = Tack;
-	netsend(&q,60);
-      }
-      break;
-    case Tack:
-      n = find_client(&q);
-      if (n != -1) clients[n].last = time(NULL);
-      break;
-    case Treset:
-      n = find_client(&q);
-      if (n != -1) {
-	int i;
-	char msg[MAX_PAYLOAD];
-	char aea[16];
-
-	clients[n].last = 0;
-
-	htoa(aea,(char *)q.src,6);
-	snprintf(msg,MAX_PAYLOAD,"\r\n[Console (%d) disconnected (%s-%d)]\r\n",
-		 n,aea,clients[n].conn);
-	if (debug || lconsole) fputs(msg,stderr);
-	for (i=0; i<MAX_CLIENTS;i++) 
-	  if (clients[i].last) 
-	    cec_Tdata(clients[i].addr,clients[i].conn,++clients[i].seq,msg);
-      }
-      break;
-    case Tdiscover:
-      {
-	struct utsname u;
-	uname(&u);
-	snprintf((char *)q.data,MAX_PAYLOAD,"%d\t%s %s %s %s",
-		 shelf,u.nodename,u.sysname,u.release,u.machine);
-		 
-	q.type = Toffer;
-	q.len = strlen((char *)q.data);
-	netsend(&q,HDRSIZ+q.len);
-      }
-      break;
-    }
-  } else {
-    fputs("netrecv: EOF\r\n",stderr);
-    rawoff();
-    exit(1);
-  }
-}
-
-void local_data(void) {
-  int c;
-  char buf[MAX_PAYLOAD];
-
-  c = read(0,buf,MAX_PAYLOAD);
-  if (c > 0) {
-    write(ofd,buf,c);
-    return;
-  }
-  if (c < 0) {
-    if (errno == EINTR) return;
-
-    for (c=0;c < MAX_CLIENTS;c++) {
-      if (clients[c].last) {
-	cec_Tdata(clients[c].addr,clients[c].conn,++clients[c].seq,
-		  "\r\n[process error]\r\n");
-	cec_Treset(clients[c].addr,clients[c].conn);
-      }
+  con->ifd = con->ofd = open(dev,O_RDWR|O_NOCTTY);
+  if (con->ifd == -1) fatal(dev);
+  fcntl(con->ifd,F_SETFD,FD_CLOEXEC);
+  if (tcgetattr(con->ifd,&t) == -1) return;	/* Not a tty... */
+  cfmakeraw(&t);
+  t.c_cflag |= CLOCAL | CREAD;
+  if (speed) {
+    for (i=0; speeds[i].bps && speeds[i].bps != speed; i++);
+    if (!speeds[i].bps) {
+      fprintf(stderr,"%s: unsupported speed %d\n",dev,speed);
+      exit(1);
     }
-
-    rawoff();
-    //TRC;
-    fatal("read(stdin)");
+    cfsetispeed(&t,speeds[i].code);
+    cfsetospeed(&t,speeds[i].code);
   }
-  fputs("[EOF] read(stdin)",stderr);
-  lconsole = 0;
-
+  if (tcsetattr(con->ifd,TCSANOW,&t) == -1) fatal(dev);
 }
 
 void usage(void) {
-  fprintf(stderr,"Usage:\n\t%s [-l][-w wait][-s shelf][-v][-?] eth [cmd]\n",
-	  progname);
+  fprintf(stderr,"Usage:\n\t%s [-l][-b size][-q lag][-r replay][-w wait][-s shelf][-v][-?] eth [cmd]\n"
+	  "\t%s [-b size][-q lag][-r replay][-w wait][-v][-?] -c conf eth\n"
+	  "\tlogging: [-L dir][-S segsize][-K keep][-z]\n",
+	  progname,progname);
   exit(1);
 }
 
-/*
- * console server
- */
-void con_server(char *addr) {
-  int maxfd;
-
-  maxfd = (netfd > ifd ? netfd : ifd) + 1;
-  memset(clients,0,sizeof clients);
-
-  for (;;) {
-    fd_set rfds;
-    int c;
-    time_t now;
-    struct timeval tv, *tvp = NULL;
-
-    FD_ZERO(&rfds);
-    FD_SET(netfd,&rfds);
-    FD_SET(ifd,&rfds);
-    if (lconsole) FD_SET(STDIN_FILENO,&rfds);
-
-    /* Scan client table and expire idle users */
-    now = time(NULL);
-    for (c=0;c < MAX_CLIENTS;c++) {
-      if (!clients[c].last) continue;
-      if (now - clients[c].last > idle_timer) {
-	/* Client timed-out */
-	if (cec_Treset(clients[c].addr, clients[c].conn)) perror("cec_Treset");
-	clients[c].last = 0;
-      } else {
-	/* Active client... figure out when to expire them... */
-	int secs = clients[c].last + idle_timer - now;
-	
-	if (tvp) {
-	  if (tv.tv_sec > secs) tv.tv_sec = secs;
-	} else {
-	  tv.tv_sec = secs;
-	  tv.tv_usec = 0;
-	  tvp = &tv;
-	}
-      }
-    }
-
-    c = select(maxfd,&rfds,NULL,NULL,tvp);
-    if (c == -1 && errno != EINTR) {
-      rawoff();
-      fatal("select");
-    } else if (c > 0) {
-      if (FD_ISSET(ifd,&rfds)) {
-	ifd_data();
-      }
-      if (FD_ISSET(netfd,&rfds)) {
-	c = netrecv();
-	if (c < 0) {
-	  if (errno == EINTR) continue;
-	  rawoff();
-	  if (errno == ENETDOWN) {
-	    /*
-	     * IF went down...
-	     *	re-up...
-	     */
-	    if (netup(addr)) fatal("netup");
-	    if (netopen(addr)) fatal("netopen");
-	    if (lconsole) rawon();
-	    continue;
-	  }
-	  fatal("netrecv");
-	}
-	net_data();
-      }
-      if (lconsole && FD_ISSET(0,&rfds)) {
-	local_data();
-      }
-    }
-  }
-}
-
 //void sighup(int n) {
 //  if (lconsole) rawon();
 //}
 
 void sigchld(int n) {
-  while (wait(&n) != -1);
-  rawoff();
-  exit(n);
+  pid_t pid;
+
+  while ((pid = waitpid(-1,&n,WNOHANG)) > 0) {
+    /* Consoles are shut down when their pipes hit EOF */
+    if (conffile || pid != consoles[0].pid) continue;
+    rawoff();
+    exit(n);
+  }
 }
 
 void sigusr1(int n) {
   FILE *fp;
   char aea[16];
-  extern char srcaddr[6];
+  int i;
 
   if (!outfile) return;
   fp = fopen(outfile,"w");
   if (!fp) return;
-  htoa(aea,(char *)srcaddr,6);
-  fprintf(fp,"%d %s\n",shelf,aea);
+  for (i = 0; i < nconsoles; i++) {
+    for (n = 0; n < nnetifs; n++) {
+      htoa(aea,consoles[i].lec.ea[n],6);
+      fprintf(fp,"%d %s\n",consoles[i].lec.shelf,aea);
+    }
+  }
+  fclose(fp);
+}
+
+/*
+ * Read the concentrator configuration
+ */
+void read_conf(char *file) {
+  FILE *fp;
+  char line[1024], *sh, *p;
+  int lno = 0;
+
+  if ((fp = fopen(file,"r")) == NULL) fatal(file);
+  while (fgets(line,sizeof line,fp)) {
+    ++lno;
+    sh = line + strspn(line," \t\r\n");
+    if (*sh == '#' || *sh == 0) continue;
+    p = sh + strcspn(sh," \t\r\n");
+    if (*p) *p++ = 0;
+    /* The console spec is the rest of the line */
+    p += strspn(p," \t");
+    p[strcspn(p,"\r\n")] = 0;
+    if (*p == 0) {
+      fprintf(stderr,"%s:%d: syntax error\n",file,lno);
+      exit(1);
+    }
+    new_console(strcmp(sh,"-") ? atoi(sh) : -1,strdup(p));
+  }
   fclose(fp);
+  if (nconsoles == 0) {
+    fprintf(stderr,"%s: no consoles defined\n",file);
+    exit(1);
+  }
+}
+
+/*
+ * Start the consoles read from the configuration file
+ */
+void open_consoles(void) {
+  int i;
+
+  for (i = 0; i < nconsoles; i++) {
+    struct console *con = &consoles[i];
+
+    if (con->name[0] == '|') {
+      char *argv[] = { "/bin/sh", "-c", con->name+1, NULL };
+      con_spawn(con,argv);
+    } else if (con->name[0] == '/') {
+      char *speed, *dev = strdup(con->name);
+      strtok(dev," \t");
+      speed = strtok(NULL," \t");
+      con_tty(con,dev,speed ? atoi(speed) : 0);
+      free(dev);
+    } else {
+      fprintf(stderr,"%s: %s: unknown console type\n",conffile,con->name);
+      exit(1);
+    }
+  }
 }
 
 
+
 int main(int argc,char **argv) {
   int ch;
   progname = *argv;
 
-  while ((ch=getopt(argc,argv,"df:i:ls:vw:?")) != -1) {
+  while ((ch=getopt(argc,argv,"b:c:df:H:i:K:lL:q:r:s:S:vw:z?")) != -1) {
     switch (ch) {
+    case 'b':
+      {
+	long long sz = parsesize(optarg);
+	if (sz < MAX_PAYLOAD || sz > (1LL<<30)) {
+	  fputs("invalid b value, ignoring.\n",stderr);
+	  break;
+	}
+	for (ringsz = MAX_PAYLOAD+1; ringsz < sz; ringsz <<= 1);
+      }
+      break;
+    case 'q':
+      if ((maxlag = parsesize(optarg)) < MAX_PAYLOAD) {
+	fputs("invalid q value, ignoring.\n",stderr);
+	maxlag = MAX_LAG;
+      }
+      break;
+    case 'r':
+      {
+	int l = strlen(optarg);
+	replay_lines = l && (optarg[l-1] == 'l' || optarg[l-1] == 'L');
+	if (replay_lines) optarg[l-1] = 0;
+	replay = parsesize(optarg);
+	if (replay < 0) {
+	  fputs("invalid r value, ignoring.\n",stderr);
+	  replay = REPLAY_LINES;
+	  replay_lines = 1;
+	}
+      }
+      break;
+    case 'c':
+      conffile = optarg;
+      break;
+    case 'H':
+      if ((history_max = parsesize(optarg)) <= 0) {
+	fputs("invalid H value, ignoring.\n",stderr);
+	history_max = HISTORY_MAX;
+      }
+      break;
+    case 'K':
+      logkeep = atoi(optarg);
+      break;
+    case 'L':
+      logdir = optarg;
+      break;
+    case 'S':
+      if ((logseg = parsesize(optarg)) < 4096) {
+	fputs("invalid S value, ignoring.\n",stderr);
+	logseg = LOG_SEGMENT;
+      }
+      break;
+    case 'z':
+      logzip = 1;
+      break;
     case 'f':
       outfile = optarg;
       break;
@@ -548,74 +451,40 @@ int main(int argc,char **argv) {
 	    progname);
     exit(1);
   }
+  if (conffile && (argc > 1 || lconsole || shelf != -1)) {
+    fprintf(stderr,"%s: Option -c can not be used with -l, -s or a command\n",
+	    progname);
+    exit(1);
+  }
+
+  if (conffile)
+    read_conf(conffile);
+  else
+    new_console(shelf,argc > 1 ? argv[1] : "stdio");
 
   //TRC;
   if (netup(argv[0])) fatal("netup");
   if (netopen(argv[0])) fatal("netopen");
   //TRC;
 
-  if (shelf == -1) {
-    /* Auto assign shelf number */
-    struct Shelf *s,*r = cec_probe(waitsecs,0,NULL);
-    int count = 0;
-
-    for (s=r; s ; s = s->next) {
-      if (s->shelfno > shelf) shelf = s->shelfno;
-      count++;
-    }
-    if (shelf >= count) {
-      /* OK, there should be un-assigned numbers in between...*/
-      int again;
-      again = 1;
-      shelf = 0;	/* Start searching from zero ... */
-
-      while (again) {
-	again = 0;
-	for (s=r; s ; s = s->next) {
-	  if (s->shelfno == shelf) {
-	    ++shelf; /* Shelf number in use... search the next one */
-	    again = 1;
-	    break;
-	  }
-	}
-      }
-    } else 
-      ++shelf;
-
-    freeprobe(s);
-    fprintf(stderr,"Will use shelfno %d\n",shelf);
-  } else {
-    struct Shelf *s = cec_probe(waitsecs,shelf,NULL);
-    if (s) {
-      char aea[16];
-      htoa(aea,s->ea,6);
-      fprintf(stderr,"shelf %d (%s) already exists at %s\n",
-	      shelf,s->str,aea);
-      freeprobe(s);
-      exit(1);
-    }
-  }
+  srv_init();
+  shelf = consoles[0].lec.shelf;
 
-  if (argc <= 1) {
+  if (outfile) signal(SIGUSR1,sigusr1);
+  if (conffile) {
+    signal(SIGCHLD,sigchld);
+    signal(SIGPIPE,SIG_IGN);
+    open_consoles();
+  } else if (argc <= 1) {
     /* No command is needed */
-    ifd = STDIN_FILENO;
-    ofd = STDOUT_FILENO;
+    consoles[0].ifd = STDIN_FILENO;
+    consoles[0].ofd = STDOUT_FILENO;
     signal(SIGTERM,SIG_IGN);
-    if (outfile) signal(SIGUSR1,sigusr1);
-    con_server(*argv);
   } else {
-    if (init_fds()) {
-      /* exec process... */
-      netclose();
-      execvp(argv[1],argv+1);
-      //TRC;
-      fatal("exec");
-    } else {
-      if (outfile) signal(SIGUSR1,sigusr1);
-      signal(SIGCHLD,sigchld);
-      if (lconsole) rawon();
-      con_server(*argv);
-    }
+    signal(SIGCHLD,sigchld);
+    con_spawn(consoles,argv+1);
+    if (lconsole) rawon();
   }
+  con_server();
   return 0;
 }
@@ -0,0 +1,358 @@
+/*
+ * Console logging
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Console output is written to disk by a separate writer process so
+ * that a slow disk never holds up the event loop.  The writer reads
+ * straight out of the scrollback rings, which are allocated in shared
+ * memory, and is woken through a pipe when it has gone idle.
+ *
+ * Each stream is stored as fixed size segments named
+ * <dir>/<name>.<n>.log holding bytes n*segsz to (n+1)*segsz-1 of the
+ * stream.  The position of a byte in its segment is its offset into
+ * the stream, so output lost because the writer fell behind shows up
+ * as a hole rather than shifting everything after it.
+ */
+#include "cec.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+
+enum {
+  LOG_CHUNK = 64<<10,	/* Bytes copied out of a ring at a time */
+  LOG_POLL = 1000,	/* ms between checks if nobody wakes us */
+};
+
+struct logshm {
+  offset_t head;	/* Published by the server */
+  int idle;		/* Writer is waiting for the doorbell */
+};
+
+static struct logstream {
+  char name[32];
+  char *ring;
+  unsigned long ringsz;
+  struct logshm *shm;
+  offset_t off;		/* Next byte to write */
+  offset_t seg;		/* Segment open in fd */
+  int fd;
+  offset_t rseg;	/* Segment open in rfd (server side) */
+  int rfd;
+} *streams;
+static int nstreams;
+
+static char *logdir;
+static offset_t segsz;
+static int keep, compress;
+static int bell[2] = { -1, -1 };
+static struct logshm *shared;
+
+/*
+ * Allocate memory that the writer process can see
+ */
+void *log_alloc(unsigned long len) {
+  void *p = mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+void log_segname(char *buf, int len, char *name, offset_t seg, char *ext) {
+  snprintf(buf,len,"%s/%s.%06llu.log%s",logdir,name,seg,ext);
+}
+
+void log_init(char *dir, offset_t size, int nkeep, int gzip) {
+  logdir = dir;
+  segsz = size;
+  keep = nkeep;
+  compress = gzip;
+}
+
+/*
+ * Register a stream to be logged.  Returns where the stream left off
+ * the last time, so output continues after what is already on disk.
+ */
+offset_t log_stream(char *name, char *ring, unsigned long ringsz) {
+  struct logstream *ls;
+  struct dirent *de;
+  struct stat st;
+  DIR *dp;
+  char path[1024];
+  unsigned long long seg, last = 0;
+  int l = strlen(name), found = 0;
+
+  if (!logdir) return 0;
+  if (!(streams = realloc(streams,(nstreams+1) * sizeof *streams)))
+    fatal("realloc");
+  ls = &streams[nstreams++];
+  memset(ls,0,sizeof *ls);
+  snprintf(ls->name,sizeof ls->name,"%s",name);
+  ls->ring = ring;
+  ls->ringsz = ringsz;
+  ls->fd = ls->rfd = -1;
+
+  /* Find the most recent segment */
+  if (!(dp = opendir(logdir))) fatal(logdir);
+  while ((de = readdir(dp)) != NULL) {
+    if (strncmp(de->d_name,name,l) || de->d_name[l] != '.') continue;
+    if (sscanf(de->d_name+l+1,"%llu.log",&seg) != 1) continue;
+    if (!found || seg > last) last = seg;
+    found = 1;
+  }
+  closedir(dp);
+  if (found) {
+    log_segname(path,sizeof path,name,last,"");
+    if (stat(path,&st) == 0)
+      ls->off = last * segsz + st.st_size;
+    else
+      ls->off = (last + 1) * segsz;	/* Only the compressed one left */
+  }
+  return ls->off;
+}
+
+/*
+ * Let the writer know there is something new in a ring
+ */
+void log_update(int n, offset_t head) {
+  char c = 0;
+
+  if (!nstreams) return;
+  __atomic_store_n(&streams[n].shm->head,head,__ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&shared->idle,0,__ATOMIC_SEQ_CST))
+    write(bell[1],&c,1);
+}
+
+/*
+ * Drop old segments and compress the one we just finished with
+ */
+static void log_rotate(struct logstream *ls, offset_t done) {
+  char path[1024];
+  pid_t pid;
+
+  if (keep && done + 1 >= keep) {
+    offset_t old = done + 1 - keep;
+    log_segname(path,sizeof path,ls->name,old,"");
+    unlink(path);
+    log_segname(path,sizeof path,ls->name,old,".gz");
+    unlink(path);
+    if (old == done) return;
+  }
+  if (compress) {
+    log_segname(path,sizeof path,ls->name,done,"");
+    if ((pid = fork()) == 0) {
+      execlp("gzip","gzip","-f",path,(char *)NULL);
+      _exit(127);
+    }
+    if (pid == -1) perror("fork(gzip)");
+  }
+}
+
+static int log_open(struct logstream *ls, offset_t seg) {
+  char path[1024];
+
+  if (ls->fd != -1) {
+    close(ls->fd);
+    if (seg > ls->seg) log_rotate(ls,ls->seg);
+  }
+  ls->seg = seg;
+  log_segname(path,sizeof path,ls->name,seg,"");
+  ls->fd = open(path,O_WRONLY|O_CREAT,0644);
+  if (ls->fd == -1) perror(path);
+  return ls->fd;
+}
+
+/*
+ * Copy whatever is new in a ring to disk.  Returns 1 if it caught up.
+ */
+static int log_drain(struct logstream *ls) {
+  static char buf[LOG_CHUNK];
+  char *p = buf;
+  offset_t head, tail, start, seg;
+  unsigned long pos;
+  int len, l;
+
+  head = __atomic_load_n(&ls->shm->head,__ATOMIC_SEQ_CST);
+  if (ls->off >= head) return 1;
+
+  tail = head > ls->ringsz ? head - ls->ringsz : 0;
+  if (ls->off < tail) ls->off = tail;	/* Fell behind, leave a hole */
+
+  start = ls->off;
+  len = head - start > LOG_CHUNK ? LOG_CHUNK : head - start;
+  pos = start & (ls->ringsz-1);
+  l = ls->ringsz - pos < len ? ls->ringsz - pos : len;
+  memcpy(buf,ls->ring+pos,l);
+  memcpy(buf+l,ls->ring,len-l);
+
+  /* Did the server write over what we just copied? */
+  head = __atomic_load_n(&ls->shm->head,__ATOMIC_SEQ_CST);
+  tail = head > ls->ringsz ? head - ls->ringsz : 0;
+  if (tail > start) {
+    if (tail >= start + len) {
+      ls->off = tail;
+      return 0;
+    }
+    p += tail - start;
+    len -= tail - start;
+    start = tail;
+  }
+
+  while (len > 0) {
+    seg = start / segsz;
+    l = (seg + 1) * segsz - start;
+    if (l > len) l = len;
+    if (seg != ls->seg || ls->fd == -1)
+      if (log_open(ls,seg) == -1) break;
+    if (pwrite(ls->fd,p,l,start - seg * segsz) != l) {
+      perror("pwrite");
+      break;
+    }
+    p += l;
+    start += l;
+    len -= l;
+  }
+  ls->off = start + len;
+  return ls->off >= __atomic_load_n(&ls->shm->head,__ATOMIC_SEQ_CST);
+}
+
+static void log_writer(void) {
+  struct pollfd pfd;
+  char junk[256];
+  int i, done;
+
+  signal(SIGCHLD,SIG_DFL);
+  signal(SIGTERM,SIG_IGN);	/* We leave when the server does */
+  signal(SIGINT,SIG_IGN);
+  signal(SIGUSR1,SIG_IGN);
+  pfd.fd = bell[0];
+  pfd.events = POLLIN;
+
+  for (;;) {
+    do {
+      done = 1;
+      for (i = 0; i < nstreams; i++)
+	done &= log_drain(&streams[i]);
+    } while (!done);
+
+    /* Catch anything published before we said we were idle */
+    __atomic_store_n(&shared->idle,1,__ATOMIC_SEQ_CST);
+    for (i = 0; i < nstreams; i++) done &= log_drain(&streams[i]);
+    if (!done) continue;
+
+    while (waitpid(-1,NULL,WNOHANG) > 0);	/* gzip's */
+    if (poll(&pfd,1,LOG_POLL) > 0) {
+      if (read(bell[0],junk,sizeof junk) == 0) {
+	/* Server is gone, write what is left and leave */
+	for (i = 0; i < nstreams; i++)
+	  while (!log_drain(&streams[i]));
+	exit(0);
+      }
+    }
+  }
+}
+
+/*
+ * Fork the writer process.  Streams must have been registered and
+ * their rings allocated with log_alloc().
+ */
+void log_start(void) {
+  int i;
+  pid_t pid;
+
+  if (!nstreams) return;
+  if (!(shared = log_alloc(sizeof(struct logshm) * (nstreams + 1))))
+    fatal("mmap");
+  for (i = 0; i < nstreams; i++) {
+    streams[i].shm = &shared[i+1];
+    streams[i].shm->head = streams[i].off;
+  }
+  if (pipe(bell) == -1) fatal("pipe");
+
+  if ((pid = fork()) == -1) fatal("fork");
+  if (pid == 0) {
+    close(bell[1]);
+    netclose();
+    log_writer();
+  }
+  close(bell[0]);
+  fcntl(bell[1],F_SETFD,FD_CLOEXEC);
+  fcntl(bell[1],F_SETFL,O_NONBLOCK);
+}
+
+/*
+ * Read back logged output of stream n.  Returns 0 if that part of
+ * the stream is not on disk (not written yet, expired or compressed).
+ */
+int log_read(int n, offset_t off, char *buf, int len) {
+  struct logstream *ls;
+  char path[1024];
+  offset_t seg = off / segsz;
+
+  if (n >= nstreams) return 0;
+  ls = &streams[n];
+  if (ls->rfd == -1 || ls->rseg != seg) {
+    if (ls->rfd != -1) close(ls->rfd);
+    log_segname(path,sizeof path,ls->name,seg,"");
+    ls->rseg = seg;
+    if ((ls->rfd = open(path,O_RDONLY)) == -1) return 0;
+    fcntl(ls->rfd,F_SETFD,FD_CLOEXEC);
+  }
+  if (off + len > (seg + 1) * segsz) len = (seg + 1) * segsz - off;
+  len = pread(ls->rfd,buf,len,off - seg * segsz);
+  return len > 0 ? len : 0;
+}
+
+/*
+ * Oldest part of a stream that may still be on disk
+ */
+offset_t log_oldest(offset_t head) {
+  offset_t seg = head / segsz;
+
+  if (!keep || seg + 1 < keep) return 0;
+  return (seg + 1 - keep) * segsz;
+}
+
+/*
+ * Open the time index of a stream, <dir>/<name>.idx.  It is a
+ * sequence of struct logidx records.
+ */
+int log_idxopen(char *name) {
+  char path[1024];
+  int fd;
+
+  if (!logdir) return -1;
+  snprintf(path,sizeof path,"%s/%s.idx",logdir,name);
+  if ((fd = open(path,O_RDWR|O_APPEND|O_CREAT,0644)) == -1)
+    perror(path);
+  else
+    fcntl(fd,F_SETFD,FD_CLOEXEC);
+  return fd;
+}
@@ -0,0 +1,655 @@
+/*
+ * Console server engine
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * This is the part of ec-drv that serves consoles to CEC clients.  It
+ * is also linked into sled so that it can serve its pty without
+ * running a separate ec-drv.
+ *
+ * Console output is read into a per-console scrollback ring and every
+ * client is sent frames out of it at its own pace.
+ */
+#include "cec.h"
+#include "ec-srv.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+
+extern int debug;
+extern char *progname;
+
+struct console *consoles;
+int nconsoles = 0;
+
+int lconsole = 0;
+int localfd = STDERR_FILENO;	/* Where -l echoes console output */
+int waitsecs = WAITSECS;
+int idle_timer = IDLE_TIMER;
+unsigned long ringsz = RING_SIZE;
+long long replay = REPLAY_LINES;
+int replay_lines = 1;	/* replay is in lines rather than bytes */
+char *logdir = NULL;
+offset_t logseg = LOG_SEGMENT;
+int logkeep = 0;
+int logzip = 0;
+long long history_max = HISTORY_MAX;
+long long maxlag = MAX_LAG;
+
+static struct lec_ops srv_ops;
+
+/*
+ * Allocate a console slot
+ */
+struct console *new_console(int shelfno, char *name) {
+  struct console *con;
+
+  if (nconsoles == MAX_CONSOLES) {
+    fprintf(stderr,"%s: too many consoles\n",progname);
+    exit(1);
+  }
+  if (!consoles) {
+    consoles = (struct console *)calloc(MAX_CONSOLES,sizeof(struct console));
+    if (!consoles) fatal("calloc");
+  }
+  con = &consoles[nconsoles++];
+  if ((con->ring = log_alloc(ringsz)) == NULL) fatal("mmap(ring)");
+  lec_init(&con->lec,shelfno,&srv_ops,con);
+  con->ifd = con->ofd = con->idxfd = -1;
+  con->name = name;
+  return con;
+}
+
+/*
+ * Copy console output starting at "off" out of the scrollback
+ */
+int ring_read(struct console *con, offset_t off, char *buf, int len) {
+  unsigned long pos = off & (ringsz-1);
+
+  if (off + len > con->head) len = con->head - off;
+  if (pos + len > ringsz) {
+    memcpy(buf,con->ring+pos,ringsz-pos);
+    memcpy(buf+ringsz-pos,con->ring,len-(ringsz-pos));
+  } else
+    memcpy(buf,con->ring+pos,len);
+  return len;
+}
+
+/*
+ * Oldest byte still in the scrollback
+ */
+offset_t ring_tail(struct console *con) {
+  return con->head - con->base > ringsz ? con->head - ringsz : con->base;
+}
+
+/*
+ * Oldest output we may still have, in the scrollback or on disk
+ */
+offset_t hist_oldest(struct console *con) {
+  return logdir ? log_oldest(con->head) : ring_tail(con);
+}
+
+/*
+ * Copy console output starting at "off" from the scrollback or, if it
+ * has already left it, from the log.  Returns 0 if it is gone.
+ */
+int hist_read(struct console *con, offset_t off, char *buf, int len) {
+  offset_t tail = ring_tail(con);
+
+  if (off >= tail) return ring_read(con,off,buf,len);
+  if (!logdir) return 0;
+  if (off + len > tail) len = tail - off;
+  return log_read(con - consoles,off,buf,len);
+}
+
+/*
+ * Add a time index entry
+ */
+void tidx_add(struct console *con, time_t t, offset_t off) {
+  struct logidx *e;
+  offset_t oldest = hist_oldest(con);
+
+  /* Forget entries for output that is gone */
+  while (con->tcount > 1 && con->tidx[con->tfirst+1].off <= oldest) {
+    con->tfirst++;
+    con->tcount--;
+  }
+  if (con->tfirst + con->tcount == con->tmax) {
+    if (con->tfirst > con->tmax / 2) {
+      memmove(con->tidx,con->tidx+con->tfirst,con->tcount * sizeof *e);
+      con->tfirst = 0;
+    } else {
+      con->tmax = con->tmax ? con->tmax * 2 : 1024;
+      if (!(con->tidx = realloc(con->tidx,con->tmax * sizeof *e)))
+	fatal("realloc(tidx)");
+    }
+  }
+  e = &con->tidx[con->tfirst + con->tcount++];
+  e->t = t;
+  e->off = off;
+  if (con->idxfd != -1 && write(con->idxfd,e,sizeof *e) != sizeof *e)
+    perror("write(idx)");
+}
+
+/*
+ * Find the first output written at or after time t
+ */
+offset_t tidx_find(struct console *con, time_t t) {
+  struct logidx *e = con->tidx + con->tfirst;
+  int lo = 0, hi = con->tcount;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (e[mid].t < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == con->tcount) return con->head;
+  if (e[lo].off < hist_oldest(con)) return hist_oldest(con);
+  return e[lo].off;
+}
+
+/*
+ * Load the time index saved in the log directory
+ */
+void tidx_load(struct console *con, char *name) {
+  struct logidx e;
+  int fd = log_idxopen(name);
+
+  if (fd == -1) return;
+  lseek(fd,0,SEEK_SET);
+  while (read(fd,&e,sizeof e) == sizeof e) {
+    if (e.off > con->head) break;
+    tidx_add(con,e.t,e.off);
+  }
+  /* Drop what has been pruned from the log */
+  if (ftruncate(fd,0) == -1) perror("ftruncate(idx)");
+  if (con->tcount) {
+    int l = con->tcount * sizeof e;
+    if (write(fd,con->tidx+con->tfirst,l) != l) perror("write(idx)");
+  }
+  con->idxfd = fd;
+}
+
+/*
+ * Start of the last "lines" lines of output
+ */
+offset_t hist_lines(struct console *con, long long lines) {
+  char buf[4096];
+  offset_t o = con->head, oldest = hist_oldest(con);
+  long long nl = 0;
+  int n, i, first = 1;
+
+  while (o > oldest && con->head - o < history_max) {
+    n = o - oldest > sizeof buf ? sizeof buf : o - oldest;
+    if (hist_read(con,o - n,buf,n) != n) break;
+    for (i = n; i > 0; i--, o--) {
+      if (buf[i-1] != '\n') continue;
+      if (first && o == con->head) continue;	/* ends the last line */
+      if (++nl == lines) return o;
+    }
+    first = 0;
+  }
+  return o;
+}
+
+/*
+ * Where a new client starts receiving output
+ */
+offset_t replay_start(struct console *con) {
+  offset_t o = con->head, tail = ring_tail(con);
+  long long nl = 0;
+
+  if (!replay_lines)
+    return con->head - tail > replay ? con->head - replay : tail;
+
+  if (replay == 0) return o;
+  /* A trailing newline ends the last line, it doesn't start one */
+  if (o > tail && con->ring[(o-1) & (ringsz-1)] == '\n') o--;
+  for (; o > tail; o--)
+    if (con->ring[(o-1) & (ringsz-1)] == '\n' && ++nl == replay) break;
+  return o;
+}
+
+/*
+ * Queue a notice for a client, ahead of any console output
+ */
+void client_queue(struct client_t *cl, char *msg) {
+  int l = strlen(msg);
+
+  if (cl->msglen + l > MAX_PAYLOAD) l = MAX_PAYLOAD - cl->msglen;
+  memcpy(cl->msg+cl->msglen,msg,l);
+  cl->msglen += l;
+}
+
+/*
+ * Move a client that fell behind to the start of a recent line and
+ * tell it how much it missed.
+ */
+void client_resync(struct console *con, struct client_t *cl) {
+  offset_t o = con->head - maxlag / 2, tail = ring_tail(con);
+  char msg[64];
+  int i;
+
+  if (o < tail) o = tail;
+  for (i = 0; o + i < con->head && i < 1024; i++)
+    if (con->ring[(o+i) & (ringsz-1)] == '\n') {
+      o += i + 1;
+      break;
+    }
+  if (o <= cl->txoff) return;
+  snprintf(msg,sizeof msg,"\r\n[%llu bytes skipped]\r\n",o - cl->txoff);
+  cl->txoff = o;
+  client_queue(cl,msg);
+}
+
+/*
+ * Send the next frame to a client if it isn't waiting for an ack
+ */
+void client_pump(struct console *con, struct client_t *cl) {
+  struct lec_conn *lc = &con->lec.conns[cl - con->clients];
+  char *buf = (char *)lc->txpkt.data;
+  offset_t end;
+
+  if (!lc->last || lc->inflight) return;
+
+  if (cl->hend && cl->txoff >= cl->hend) {
+    /* Done with the history, back to live output */
+    cl->hend = 0;
+    cl->txoff = cl->resume;
+    client_queue(cl,"\r\n[End of history]\r\n");
+  }
+  if (!cl->hend && con->head - cl->txoff > maxlag)
+    client_resync(con,cl);
+  end = cl->hend ? cl->hend : con->head;
+
+  /* Notices go first, followed by as much output as fits */
+  cl->txlen = 0;
+  if (cl->txoff < end) {
+    int l = MAX_PAYLOAD - cl->msglen;
+    if (end - cl->txoff < l) l = end - cl->txoff;
+    if (l && !(l = hist_read(con,cl->txoff,buf+cl->msglen,l))) {
+      /* Not available any more, skip ahead */
+      if (cl->hend)
+	cl->txoff = cl->hend;
+      else
+	client_resync(con,cl);
+      client_pump(con,cl);
+      return;
+    }
+    cl->txlen = l;
+  }
+  if (!cl->msglen && !cl->txlen) return;
+  memcpy(buf,cl->msg,cl->msglen);
+  lec_write(&con->lec,lc,buf,cl->msglen + cl->txlen);
+  cl->msglen = 0;
+}
+
+/*
+ * The client got the last frame, move on to the next one
+ */
+void client_acked(struct lec *l, struct lec_conn *lc) {
+  struct console *con = l->arg;
+  struct client_t *cl = &con->clients[lc - l->conns];
+
+  cl->txoff += cl->txlen;
+  cl->txlen = 0;
+  client_pump(con,cl);
+}
+
+/*
+ * Queue a notice and send it if the client is idle
+ */
+void client_notice(struct console *con, struct client_t *cl, char *msg) {
+  client_queue(cl,msg);
+  client_pump(con,cl);
+}
+
+/*
+ * Handle a Thistory request:
+ *	t from [to]	output written between two times (unix time)
+ *	l lines		the last so many lines
+ *	b bytes		the last so many bytes
+ * The reply is bounded by history_max and once it has been sent the
+ * client picks up live output where it left off.
+ */
+void client_history(struct console *con, struct client_t *cl, char *req) {
+  char msg[MAX_PAYLOAD], when[32];
+  long long a = 0, b = -1;
+  offset_t start, end = con->head;
+  time_t t;
+
+  if (sscanf(req+1,"%lld %lld",&a,&b) < 1 || a < 0) {
+    client_notice(con,cl,"\r\n[Bad history request]\r\n");
+    return;
+  }
+  switch (req[0]) {
+  case 't':
+    start = tidx_find(con,a);
+    if (b != -1) end = tidx_find(con,b);
+    break;
+  case 'l':
+    start = hist_lines(con,a);
+    break;
+  case 'b':
+    start = a < con->head ? con->head - a : 0;
+    break;
+  default:
+    client_notice(con,cl,"\r\n[Bad history request]\r\n");
+    return;
+  }
+  if (start < hist_oldest(con)) start = hist_oldest(con);
+  if (end < start) end = start;
+
+  if (!cl->hend) {
+    /* Remember where the live output was */
+    if (con->lec.conns[cl - con->clients].inflight) {
+      cl->txoff += cl->txlen;
+      cl->txlen = 0;
+    }
+    cl->resume = cl->txoff;
+  }
+
+  t = time(NULL);
+  if (req[0] == 't') t = a;
+  strftime(when,sizeof when,"%Y-%m-%d %H:%M:%S",localtime(&t));
+  if (end - start > history_max) {
+    snprintf(msg,sizeof msg,"\r\n[History from %s, first %lld of %llu bytes]\r\n",
+	     when,history_max,end - start);
+    end = start + history_max;
+  } else
+    snprintf(msg,sizeof msg,"\r\n[History from %s, %llu bytes]\r\n",
+	     req[0] == 't' ? when : "scrollback",end - start);
+
+  cl->txoff = start;
+  cl->hend = end;
+  if (start == end) {
+    /* Nothing to send, go straight back */
+    cl->hend = 0;
+    cl->txoff = cl->resume;
+  }
+  client_notice(con,cl,msg);
+}
+
+/*
+ * Tell everybody attached to a console, except skip, something
+ */
+void con_notify(struct console *con, char *msg, struct client_t *skip) {
+  int i;
+
+  if (debug || lconsole) write(localfd,msg,strlen(msg));
+  for (i=0; i<MAX_CLIENTS;i++)
+    if (con->lec.conns[i].last && &con->clients[i] != skip)
+      client_notice(con,&con->clients[i],msg);
+}
+
+
+/*
+ * The console went away, let everybody know...
+ */
+void con_eof(struct console *con) {
+  int i;
+
+  for (i=0;i < MAX_CLIENTS;i++)
+    if (con->lec.conns[i].last)
+      lec_reset(&con->lec,&con->lec.conns[i],"[System shutdown]");
+  if (con->ofd != con->ifd) close(con->ofd);
+  close(con->ifd);
+  con->ifd = con->ofd = -1;
+
+  for (i=0; i < nconsoles; i++)
+    if (consoles[i].ifd != -1) return;
+
+  /* Nothing left to serve */
+  fputs("[EOF]\r\n",stderr);
+  rawoff();
+  exit(1);
+}
+
+void ifd_data(struct console *con) {
+  unsigned long pos = con->head & (ringsz-1);
+  time_t now;
+  int i, c;
+
+  /* Read straight into the scrollback */
+  c = ringsz - pos > READ_SIZE ? READ_SIZE : ringsz - pos;
+  c = read(con->ifd,con->ring+pos,c);
+  if (c == -1) {
+    if (errno == EINTR) return;
+    if (nconsoles > 1) {
+      perror(con->name);
+      con_eof(con);
+      return;
+    }
+    rawoff();
+    //TRC;
+    fatal("read");
+  }
+
+  if (c==0) {
+    /* Ooops ... EOF */
+    con_eof(con);
+    return;
+  }
+
+  if (debug || lconsole) write(localfd,con->ring+pos,c);
+  now = time(NULL);
+  if (!con->tcount || con->tidx[con->tfirst + con->tcount - 1].t != now)
+    tidx_add(con,now,con->head);
+  con->head += c;
+  log_update(con - consoles,con->head);
+
+  for (i=0;i<MAX_CLIENTS;i++)
+    client_pump(con,&con->clients[i]);
+}
+
+/*
+ * A client connected, send it the scrollback
+ */
+char *client_attach(struct lec *l, struct lec_conn *lc) {
+  struct console *con = l->arg;
+  struct client_t *cl = &con->clients[lc - l->conns];
+  char msg[MAX_PAYLOAD];
+  char aea[16];
+
+  htoa(aea,(char *)lc->addr,6);
+  snprintf(msg,MAX_PAYLOAD,"\r\n[New console %d attached (%s-%d)]\r\n",
+	   (int)(lc - l->conns),aea,lc->conn);
+  con_notify(con,msg,cl);
+
+  memset(cl,0,sizeof *cl);
+  cl->txoff = replay_start(con);
+  client_notice(con,cl,"[Connected]\r\n");
+  return NULL;
+}
+
+void client_input(struct lec *l, struct lec_conn *lc, int type, uchar *data, int len) {
+  struct console *con = l->arg;
+
+  if (type == Thistory)
+    client_history(con,&con->clients[lc - l->conns],(char *)data);
+  else
+    write(con->ofd,data,len);
+}
+
+void client_detach(struct lec *l, struct lec_conn *lc, char *why) {
+  char msg[MAX_PAYLOAD];
+  char aea[16];
+
+  htoa(aea,(char *)lc->addr,6);
+  snprintf(msg,MAX_PAYLOAD,"\r\n[Console (%d) %s (%s-%d)]\r\n",
+	   (int)(lc - l->conns),why,aea,lc->conn);
+  con_notify(l->arg,msg,NULL);
+}
+
+static struct lec_ops srv_ops = {
+  .attach = client_attach,
+  .input = client_input,
+  .ready = client_acked,
+  .detach = client_detach,
+};
+
+void net_data(void) {
+  struct Pkt q;
+  int n, i;
+
+  if ((n = netget(&q,sizeof q)) > 0) {
+    for (i=0; i < nconsoles; i++) {
+      if (consoles[i].ifd == -1) continue;
+      /* Only a broadcast probe is for more than one console */
+      if (lec_feed(&consoles[i].lec,netifn,&q,n) && q.type != Tdiscover)
+	break;
+    }
+  } else {
+    fputs("netrecv: EOF\r\n",stderr);
+    rawoff();
+    exit(1);
+  }
+}
+
+void local_data(void) {
+  int c;
+  char buf[MAX_PAYLOAD];
+
+  c = read(0,buf,MAX_PAYLOAD);
+  if (c > 0) {
+    write(consoles[0].ofd,buf,c);
+    return;
+  }
+  if (c < 0) {
+    struct lec *l = &consoles[0].lec;
+    if (errno == EINTR) return;
+
+    for (c=0;c < MAX_CLIENTS;c++)
+      if (l->conns[c].last)
+	lec_reset(l,&l->conns[c],"\r\n[process error]\r\n");
+
+    rawoff();
+    //TRC;
+    fatal("read(stdin)");
+  }
+  fputs("[EOF] read(stdin)",stderr);
+  lconsole = 0;
+
+}
+
+
+/*
+ * console server
+ */
+void con_server(void) {
+  for (;;) {
+    fd_set rfds;
+    int c, n, maxfd;
+    long long now, next, due;
+    struct timeval tv, *tvp = NULL;
+
+    FD_ZERO(&rfds);
+    maxfd = netfds(&rfds,0);
+    if (lconsole) FD_SET(STDIN_FILENO,&rfds);
+
+    /* Retransmit and expire idle users */
+    now = lec_now();
+    next = -1;
+    for (n=0; n < nconsoles; n++) {
+      struct console *con = &consoles[n];
+      if (con->ifd == -1) continue;
+      FD_SET(con->ifd,&rfds);
+      if (con->ifd > maxfd) maxfd = con->ifd;
+
+      due = lec_poll(&con->lec,now);
+      if (due != -1 && (next == -1 || due < next)) next = due;
+    }
+    if (next != -1) {
+      tv.tv_sec = next / 1000;
+      tv.tv_usec = (next % 1000) * 1000;
+      tvp = &tv;
+    }
+
+    c = select(maxfd+1,&rfds,NULL,NULL,tvp);
+    if (c == -1 && errno != EINTR) {
+      rawoff();
+      fatal("select");
+    } else if (c > 0) {
+      for (n=0; n < nconsoles; n++) {
+	if (consoles[n].ifd != -1 && FD_ISSET(consoles[n].ifd,&rfds))
+	  ifd_data(&consoles[n]);
+      }
+      while ((c = netrecvset(&rfds)) != 0) {
+	if (c < 0) {
+	  if (errno == EINTR) continue;
+	  rawoff();
+	  if (errno == ENETDOWN) {
+	    /*
+	     * IF went down...
+	     *	re-up...
+	     */
+	    if (netreopen(netifn)) fatal("netreopen");
+	    if (lconsole) rawon();
+	    continue;
+	  }
+	  fatal("netrecv");
+	}
+	net_data();
+      }
+      if (lconsole && FD_ISSET(0,&rfds)) {
+	local_data();
+      }
+    }
+  }
+}
+/*
+ * Get the consoles ready to be served: pick shelf numbers, work out
+ * their addresses and pick up their logs.  The network must be open.
+ */
+void srv_init(void) {
+  int shelves[MAX_CONSOLES];
+  int i;
+
+  for (i = 0; i < nconsoles; i++) shelves[i] = consoles[i].lec.shelf;
+  if (lec_assign(shelves,nconsoles,waitsecs)) exit(1);
+  for (i = 0; i < nconsoles; i++) {
+    struct lec *l = &consoles[i].lec;
+    if (l->shelf == -1)
+      fprintf(stderr,"Will use shelfno %d for %s\n",shelves[i],consoles[i].name);
+    l->shelf = shelves[i];
+    l->idle = idle_timer;
+    lec_addrs(l,i);
+  }
+
+  if (!logdir) return;
+  log_init(logdir,logseg,logkeep,logzip);
+  for (i = 0; i < nconsoles; i++) {
+    char name[32];
+    snprintf(name,sizeof name,"shelf%d",consoles[i].lec.shelf);
+    consoles[i].head = consoles[i].base =
+      log_stream(name,consoles[i].ring,ringsz);
+    tidx_load(&consoles[i],name);
+  }
+  log_start();
+}
@@ -0,0 +1,89 @@
+/*
+ * Console server engine (see ec-srv.c)
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <sys/types.h>
+#include <time.h>
+#include "lec.h"
+
+enum {
+  MAX_CLIENTS = LEC_MAXCONN,
+  IDLE_TIMER = LEC_IDLE,
+  MAX_CONSOLES = 256,	/* Consoles in concentrator mode */
+  RING_SIZE = 256<<10,	/* Default scrollback per console */
+  REPLAY_LINES = 200,	/* Default scrollback sent on attach */
+  READ_SIZE = 4096,	/* Max bytes read from a console at once */
+  LOG_SEGMENT = 16<<20,	/* Default log segment size */
+  HISTORY_MAX = 1<<20,	/* Default limit for a history request */
+  MAX_LAG = 64<<10,	/* Default limit on unsent output per client */
+};
+
+/*
+ * What we keep for each client on top of its struct lec_conn (the
+ * one with the same index in con->lec.conns)
+ */
+struct client_t {
+  offset_t txoff;	/* Next console byte to send */
+  int txlen;		/* Console bytes in the unacked frame */
+  char msg[MAX_PAYLOAD];	/* Notices queued ahead of console data */
+  int msglen;
+
+  offset_t hend;	/* End of a history replay, 0 if none */
+  offset_t resume;	/* Where live output picks up after it */
+};
+
+struct console {
+  struct lec lec;	/* Shelf, addresses and clients */
+  int ifd, ofd;		/* Input/output fd, -1 once closed */
+  pid_t pid;		/* Child process (if any) */
+  char *name;		/* tty device or command */
+  struct client_t clients[MAX_CLIENTS];
+
+  /*
+   * Scrollback.  Byte "o" of the console output lives at
+   * ring[o & (ringsz-1)] for as long as head - o <= ringsz.
+   */
+  char *ring;
+  offset_t head;	/* Total bytes read from the console */
+  offset_t base;	/* Where this run started (see -L) */
+
+  /*
+   * Sparse time index, at most one entry per second of output,
+   * oldest first starting at tidx[tfirst].
+   */
+  struct logidx *tidx;
+  int tfirst, tcount, tmax;
+  int idxfd;		/* Where the index is saved (with -L) */
+};
+
+extern struct console *consoles;
+extern int nconsoles;
+extern int lconsole, localfd, waitsecs, idle_timer;
+extern unsigned long ringsz;
+extern long long replay, history_max, maxlag;
+extern int replay_lines;
+extern char *logdir;
+extern offset_t logseg;
+extern int logkeep, logzip;
+
+struct console *new_console(int shelfno, char *name);
+void srv_init(void);
+void con_server(void);
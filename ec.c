@@ -38,6 +38,11 @@
  * pick a free shelf number or check if the specified shelf number is
  * not in use.
  *
+ * _eth_ may be a comma separated list of interfaces (e.g. _eth0,eth1_)
+ * to serve several management networks from a single daemon.  Discovery
+ * requests are answered on all of them and each client session is kept
+ * on the interface it connected from.
+ *
  * == OPTIONS
  *
  * * *-d*::
@@ -67,14 +72,13 @@
  *--
  */
 #include "cec.h"
+#include "lec.h"
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
-#include <arpa/inet.h>
-#include <sys/utsname.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/ioctl.h>
@@ -89,23 +93,19 @@
 void nca_main(void);
 
 enum {
-  MAX_CLIENTS = 4,	/* We are not too ambitious */
-  IDLE_TIMER = 300,	/* We clear clients after this many seconds */
+  IDLE_TIMER = LEC_IDLE,	/* We clear clients after this many seconds */
 };
 
-struct client_t {
-  uchar addr[6];
-  time_t last;
-  uchar conn;
-  uchar seq;
-  
-  // NCA process
+/*
+ * Each client gets its own NCA process
+ */
+struct session {
   pid_t dpid;
   int ifd,ofd;
 };
 
-extern int netfd;
-struct client_t clients[MAX_CLIENTS];
+struct lec server;
+struct session sessions[LEC_MAXCONN];
 
 int debug = 0;
 int shelf= -1;
@@ -123,121 +123,91 @@ void usage(void) {
   exit(1);
 }
 
-int find_client(struct Pkt *p) {
-  int i;
-  for (i=0;i< MAX_CLIENTS;i++) {
-    if (clients[i].last 
-	&& memcmp(clients[i].addr,p->src,6) == 0 
-	&& clients[i].conn == p->conn) 
-      return i;
-  }
-  return -1;
-}
-
-
 /*
- * Reset client connection
+ * Release a client's NCA process
  */
-void client_reset(int c) {
-  if (cec_Treset(clients[c].addr, clients[c].conn)) perror("cec_Treset");
-  clients[c].last = 0;
-  close(clients[c].ifd);
-  close(clients[c].ofd);
-  clients[c].ifd = clients[c].ofd = clients[c].dpid = 0;
+void client_reset(struct lec *l, struct lec_conn *c, char *why) {
+  struct session *ss = &sessions[c - l->conns];
+
+  close(ss->ifd);
+  close(ss->ofd);
+  ss->ifd = ss->ofd = ss->dpid = 0;
 }
 
 /*
  * Initialise a new client connection
  */
-void init_client(struct Pkt *q) {
-  int n;
+char *init_client(struct lec *l, struct lec_conn *c) {
+  struct session *ss = &sessions[c - l->conns];
   int io1[2],io2[2];
   pid_t tt;
 
-  /* Find an empty slot */
-  for (n=0;n<MAX_CLIENTS;n++)
-    if (!clients[n].last) break;
-	
-  q->type = Treset;
-  if (n == MAX_CLIENTS) {
-    strcpy((char *)q->data,"no free ports");
-    return;
+  if (pipe(io1) == -1) return "pipe(1) error";
+  if (pipe(io2) == -1) {
+    close(io1[0]);close(io1[1]);
+    return "pipe(2) error";
   }
-
-  if (pipe(io1) != -1) {
-    if (pipe(io2) != -1) {
-      if ((tt = fork()) != -1) {
-	if (tt) {
-	  /* Parent process */
-	  clients[n].last = time(NULL);
-	  memcpy(clients[n].addr,q->src,6);
-	  clients[n].conn = q->conn;
-	  clients[n].seq = q->seq;
-
-	  clients[n].dpid = tt;
-	  clients[n].ifd = io2[0]; close(io2[1]);
-	  clients[n].ofd = io1[1]; close(io1[0]);
-	  q->type = Tdata;
-	  strcpy((char *)q->data,"[Connected]\r\n");
-	  return;
-	} else {
-	  /* Child process */
-	  dup2(io1[0],STDIN_FILENO);
-	  dup2(io2[1],STDOUT_FILENO);
-	  close(netfd);
-	  close(io1[0]);close(io1[1]);
-	  close(io2[0]);close(io2[1]);
-	  for (n = 0; n<MAX_CLIENTS;n++) {
-	    if (clients[n].last) {
-	      //close(clients[n].ifd);
-	      //close(clients[n].ofd);
-	    }
-	  }
-	  /* RUN NCA */
-	  nca_main();
-	  exit(1);
-	}
-      } else 
-	strcpy((char *)q->data,"fork failed");    
-      close(io2[0]);close(io2[1]);
-    } else 
-      strcpy((char *)q->data,"pipe(2) error");
+  if ((tt = fork()) == -1) {
+    close(io2[0]);close(io2[1]);
     close(io1[0]);close(io1[1]);
-  } else
-    strcpy((char *)q->data,"pipe(1) error");
+    return "fork failed";
+  }
+  if (tt) {
+    /* Parent process */
+    ss->dpid = tt;
+    ss->ifd = io2[0]; close(io2[1]);
+    ss->ofd = io1[1]; close(io1[0]);
+    lec_write(l,c,"[Connected]\r\n",13);
+    return NULL;
+  }
+
+  /* Child process */
+  dup2(io1[0],STDIN_FILENO);
+  dup2(io2[1],STDOUT_FILENO);
+  netclose();
+  close(io1[0]);close(io1[1]);
+  close(io2[0]);close(io2[1]);
+  /* RUN NCA */
+  nca_main();
+  exit(1);
 }
 
+/*
+ * Keystrokes for the NCA process
+ */
+void client_input(struct lec *l, struct lec_conn *c, int type, uchar *data, int len) {
+  if (type == Tdata) write(sessions[c - l->conns].ofd,data,len);
+}
+
+struct lec_ops server_ops = {
+  .attach = init_client,
+  .input = client_input,
+  .detach = client_reset,
+};
+
 /*
  * Read screen dta
  */
 void ifd_data(int n) {
-  struct Pkt q;
-  int c;
+  struct lec_conn *c = &server.conns[n];
+  char buf[MAX_PAYLOAD];
+  int i;
 
-  c = read(clients[n].ifd,q.data,MAX_PAYLOAD);
-  if (c == -1) {
+  if (c->inflight) return;
+  i = read(sessions[n].ifd,buf,MAX_PAYLOAD);
+  if (i == -1) {
     if (errno == EINTR) return;
     //TRC;
     fatal("read");
   }
 
-  if (c==0) {
+  if (i==0) {
     /* Ooops ... EOF */
-    cec_Tdata(clients[n].addr,clients[n].conn,++clients[n].seq,"[EOF]");
-    cec_Treset(clients[n].addr,clients[n].conn);
-    client_reset(n);
+    lec_reset(&server,c,"[EOF]");
+    client_reset(&server,c,"EOF");
     return;
   }
-
-  q.etype = ntohs(CEC_ETYPE);
-  q.type = Tdata;
-  q.len = c;
-
-  q.conn = clients[n].conn;
-  q.seq = ++clients[n].seq;
-
-  memcpy(q.dst,clients[n].addr,6);
-  netsend(&q,HDRSIZ+q.len);
+  lec_write(&server,c,buf,i);
 }
 
 /*
@@ -248,62 +218,7 @@ void net_data(void) {
   int n;
 
   if ((n = netget(&q,sizeof q)) > 0) {
-    if (n < 60) return;
-    if (ntohs(q.etype) != CEC_ETYPE) return;
-    memcpy(q.dst,q.src,6);
-
-    switch (q.type) {
-    case Tinita:
-      /* We always say yes... */
-      q.type = Tinitb;
-      netsend(&q,60);
-      break;
-    case Tinitc:
-      n = find_client(&q);
-      if (n != -1) {
-	/* Already connected */
-	cec_Tdata(q.src,q.conn,++clients[n].seq,"[Connected]\n\n");
-	break;
-      }
-      init_client(&q);
-      netsend(&q,HDRSIZ + q.len);
-      break;
-    case Tdata:
-      n = find_client(&q);
-      if (n == -1) {
-	q.type = Treset;
-	strcpy((char *)q.data,"connection closed");
-	q.len = strlen((char *)q.data);
-	netsend(&q,HDRSIZ + q.len);	
-      } else {
-	clients[n].last = time(NULL);
-	write(clients[n].ofd,q.data,q.len);
-	q.len = 0;
-	q.type = Tack;
-	netsend(&q,60);
-      }
-      break;
-    case Tack:
-      n = find_client(&q);
-      if (n != -1) clients[n].last = time(NULL);
-      break;
-    case Treset:
-      n = find_client(&q);
-      if (n != -1) client_reset(n);
-      break;
-    case Tdiscover:
-      {
-	struct utsname u;
-	uname(&u);
-	snprintf((char *)q.data,MAX_PAYLOAD,"%d\t%s %s %s %s",
-		 shelf,u.nodename,u.sysname,u.release,u.machine);
-		 
-	q.type = Toffer;
-	q.len = strlen((char *)q.data);
-	netsend(&q,HDRSIZ+q.len);
-      }
-      break;
-    }
+    lec_feed(&server,netifn,&q,n);
   } else {
     fputs("netrecv: EOF\r\n",stderr);
     exit(1);
@@ -315,44 +230,32 @@ void net_data(void) {
 /*
  * console server
  */
-void con_server(char *addr) {
-  memset(clients,0,sizeof clients);
+void con_server(void) {
+  memset(sessions,0,sizeof sessions);
 
   for (;;) {
     int maxfd;
     fd_set rfds;
     int c;
-    time_t now;
+    long long next;
     struct timeval tv, *tvp = NULL;
 
     FD_ZERO(&rfds);
-    FD_SET(netfd,&rfds);
-
-    maxfd = netfd;
-    /* Scan client table and expire idle users */
-    now = time(NULL);
-
-    for (c=0;c < MAX_CLIENTS;c++) {
-      if (!clients[c].last) continue;
-
-      if (now - clients[c].last > idle_timer) {
-	/* Client timed-out */
-	client_reset(c);
-      } else {
-	/* Active client... figure out when to expire them... */
-	int secs = clients[c].last + idle_timer - now;
-	
-	if (clients[c].ifd > maxfd) maxfd = clients[c].ifd;
-	FD_SET(clients[c].ifd, &rfds);
-
-	if (tvp) {
-	  if (tv.tv_sec > secs) tv.tv_sec = secs;
-	} else {
-	  tv.tv_sec = secs;
-	  tv.tv_usec = 0;
-	  tvp = &tv;
-	}
-      }
+    maxfd = netfds(&rfds,0);
+
+    /* Retransmit and expire idle users */
+    next = lec_poll(&server,lec_now());
+    if (next != -1) {
+      tv.tv_sec = next / 1000;
+      tv.tv_usec = (next % 1000) * 1000;
+      tvp = &tv;
+    }
+
+    /* Only read screen data for clients that can take another frame */
+    for (c=0;c < LEC_MAXCONN;c++) {
+      if (!server.conns[c].last || server.conns[c].inflight) continue;
+      if (sessions[c].ifd > maxfd) maxfd = sessions[c].ifd;
+      FD_SET(sessions[c].ifd, &rfds);
     }
     ++maxfd;
 
@@ -360,8 +263,7 @@ void con_server(char *addr) {
     if (c == -1 && errno != EINTR) {
       fatal("select");
     } else if (c > 0) {
-      if (FD_ISSET(netfd,&rfds)) {
-	c = netrecv();
+      while ((c = netrecvset(&rfds)) != 0) {
 	if (c < 0) {
 	  if (errno == EINTR) continue;
 	  if (errno == ENETDOWN) {
@@ -369,17 +271,16 @@ void con_server(char *addr) {
 	     * IF went down...
 	     *	re-up...
 	     */
-	    if (netup(addr)) fatal("netup");
-	    if (netopen(addr)) fatal("netopen");
+	    if (netreopen(netifn)) fatal("netreopen");
 	    continue;
 	  }
 	  fatal("netrecv");
 	}
 	net_data();
       }
-      for (c = 0; c <MAX_CLIENTS;c++) {
-	if (!clients[c].last) continue;
-	if (FD_ISSET(clients[c].ifd,&rfds)) {
+      for (c = 0; c <LEC_MAXCONN;c++) {
+	if (!server.conns[c].last || !sessions[c].ifd) continue;
+	if (FD_ISSET(sessions[c].ifd,&rfds)) {
 	  ifd_data(c);
 	}
       }
@@ -432,50 +333,15 @@ int main(int argc,char **argv) {
   if (netopen(argv[0])) fatal("netopen");
   //TRC;
 
-  if (shelf == -1) {
-    /* Auto assign shelf number */
-    struct Shelf *s,*r = cec_probe(waitsecs,0,NULL);
-    int count = 0;
-
-    for (s=r; s ; s = s->next) {
-      if (s->shelfno > shelf) shelf = s->shelfno;
-      count++;
-    }
-    if (shelf >= count) {
-      /* OK, there should be un-assigned numbers in between...*/
-      int again;
-      again = 1;
-      shelf = 0;	/* Start searching from zero ... */
-
-      while (again) {
-	again = 0;
-	for (s=r; s ; s = s->next) {
-	  if (s->shelfno == shelf) {
-	    ++shelf; /* Shelf number in use... search the next one */
-	    again = 1;
-	    break;
-	  }
-	}
-      }
-    } else 
-      ++shelf;
-
-    freeprobe(s);
-    fprintf(stderr,"Will use shelfno %d\n",shelf);
-  } else {
-    struct Shelf *s = cec_probe(waitsecs,shelf,NULL);
-    if (s) {
-      char aea[16];
-      htoa(aea,s->ea,6);
-      fprintf(stderr,"shelf %d (%s) already exists at %s\n",
-	      shelf,s->str,aea);
-      freeprobe(s);
-      exit(1);
-    }
-  }
+  ch = shelf;
+  if (lec_assign(&shelf,1,waitsecs)) exit(1);
+  if (ch == -1) fprintf(stderr,"Will use shelfno %d\n",shelf);
+  lec_init(&server,shelf,&server_ops,NULL);
+  server.idle = idle_timer;
+  lec_addrs(&server,0);
 
   signal(SIGCHLD,SIG_IGN);
-  con_server(*argv);
+  con_server();
   return 0;
 }
 
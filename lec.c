@@ -0,0 +1,315 @@
+/*
+ * Embeddable CEC server (liblec)
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "cec.h"
+#include "lec.h"
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uchar bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+long long lec_now(void) {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+void lec_init(struct lec *l, int shelf, struct lec_ops *ops, void *arg) {
+  memset(l,0,sizeof *l);
+  l->shelf = shelf;
+  l->idle = LEC_IDLE;
+  l->ops = ops;
+  l->arg = arg;
+}
+
+/*
+ * Work out the addresses of the n-th console of this process.  The
+ * first one uses the interface address, the rest use locally
+ * administered addresses derived from it.
+ */
+void lec_addrs(struct lec *l, int n) {
+  int i;
+
+  for (i = 0; i < nnetifs; i++) {
+    memcpy(l->ea[i],netifs[i].addr,6);
+    if (n == 0) continue;
+    l->ea[i][0] |= 0x02;
+    l->ea[i][4] ^= n >> 8;
+    l->ea[i][5] ^= n & 0xff;
+    if (netaddmac(i,l->ea[i])) fatal("netaddmac");
+  }
+}
+
+static int lec_send(struct lec *l, int ifn, struct Pkt *q, int len) {
+  if (l->ops && l->ops->send) return l->ops->send(l,ifn,q,len);
+  return netsendas(ifn,l->ea[ifn],q,len);
+}
+
+/*
+ * Answer a frame
+ */
+static void lec_reply(struct lec *l, int ifn, struct Pkt *p, int type, char *msg) {
+  struct Pkt q;
+
+  memcpy(q.dst,p->src,6);
+  q.etype = htons(CEC_ETYPE);
+  q.type = type;
+  q.conn = p->conn;
+  q.seq = p->seq;
+  q.len = msg ? strlen(msg) : 0;
+  if (msg) memcpy(q.data,msg,q.len);
+  lec_send(l,ifn,&q,HDRSIZ + q.len);
+}
+
+static void lec_discover(struct lec *l, int ifn, struct Pkt *p) {
+  char buf[MAX_PAYLOAD];
+  struct utsname u;
+
+  uname(&u);
+  snprintf(buf,sizeof buf,"%d\t%s %s %s %s",
+	   l->shelf,u.nodename,u.sysname,u.release,u.machine);
+  lec_reply(l,ifn,p,Toffer,buf);
+}
+
+static struct lec_conn *lec_find(struct lec *l, int ifn, struct Pkt *p) {
+  struct lec_conn *c;
+
+  for (c = l->conns; c < l->conns + LEC_MAXCONN; c++) {
+    if (c->last
+	&& c->conn == p->conn
+	&& c->ifn == ifn
+	&& memcmp(c->addr,p->src,6) == 0)
+      return c;
+  }
+  return NULL;
+}
+
+static void lec_acked(struct lec *l, struct lec_conn *c) {
+  c->inflight = 0;
+  if (l->ops && l->ops->ready) l->ops->ready(l,c);
+}
+
+static void lec_gone(struct lec *l, struct lec_conn *c, char *why) {
+  c->last = 0;
+  c->inflight = 0;
+  if (l->ops && l->ops->detach) l->ops->detach(l,c,why);
+}
+
+/*
+ * Handle a frame received on interface ifn.  Returns 1 if it was for
+ * this console.  Only the byte after the payload is touched (to
+ * terminate requests), so a broadcast can be fed to every console.
+ */
+int lec_feed(struct lec *l, int ifn, struct Pkt *p, int len) {
+  struct lec_conn *c;
+  char *why;
+
+  if (len < 60 || ntohs(p->etype) != CEC_ETYPE) return 0;
+  if (memcmp(p->dst,l->ea[ifn],6) != 0
+      && !(p->type == Tdiscover && memcmp(p->dst,bcast,6) == 0))
+    return 0;
+
+  c = lec_find(l,ifn,p);
+  switch (p->type) {
+  case Tinita:
+    /* We always say yes... */
+    lec_reply(l,ifn,p,Tinitb,NULL);
+    break;
+  case Tinitc:
+    if (c) {
+      /* Already connected */
+      c->last = time(NULL);
+      break;
+    }
+    for (c = l->conns; c < l->conns + LEC_MAXCONN && c->last; c++);
+    if (c == l->conns + LEC_MAXCONN) {
+      lec_reply(l,ifn,p,Treset,"no free ports");
+      break;
+    }
+    memset(c,0,sizeof *c);
+    c->last = time(NULL);
+    memcpy(c->addr,p->src,6);
+    c->ifn = ifn;
+    c->conn = p->conn;
+    c->seq = p->seq;
+    c->rseq = -1;
+    if (l->ops && l->ops->attach && (why = l->ops->attach(l,c))) {
+      c->last = 0;
+      lec_reply(l,ifn,p,Treset,why);
+    }
+    break;
+  case Tdata:
+  case Thistory:
+    if (!c) {
+      lec_reply(l,ifn,p,Treset,"connection closed");
+      break;
+    }
+    c->last = time(NULL);
+    if (p->seq != c->rseq) {
+      /* Not a retransmission */
+      c->rseq = p->seq;
+      p->data[p->len] = 0;
+      if (l->ops && l->ops->input)
+	l->ops->input(l,c,p->type,p->data,p->len);
+    }
+    lec_reply(l,ifn,p,Tack,NULL);
+    break;
+  case Tack:
+    if (!c) break;
+    c->last = time(NULL);
+    if (c->inflight && p->seq == c->txpkt.seq) lec_acked(l,c);
+    break;
+  case Treset:
+    if (c) lec_gone(l,c,"disconnected");
+    break;
+  case Tdiscover:
+    lec_discover(l,ifn,p);
+    break;
+  }
+  return 1;
+}
+
+/*
+ * Send a frame of output to a client.  Returns -1 if the previous
+ * one has not been acked yet.  data may point at c->txpkt.data.
+ */
+int lec_write(struct lec *l, struct lec_conn *c, void *data, int len) {
+  struct Pkt *q = &c->txpkt;
+
+  if (!c->last || c->inflight) return -1;
+  if (len > MAX_PAYLOAD) len = MAX_PAYLOAD;
+  if (data != q->data) memcpy(q->data,data,len);
+  memcpy(q->dst,c->addr,6);
+  q->etype = htons(CEC_ETYPE);
+  q->type = Tdata;
+  q->conn = c->conn;
+  q->seq = ++c->seq;
+  q->len = len;
+  c->inflight = 1;
+  c->retries = 0;
+  c->sent = lec_now();
+  lec_send(l,c->ifn,q,HDRSIZ + len);
+  return len;
+}
+
+/*
+ * Drop a client, optionally telling it why first
+ */
+int lec_reset(struct lec *l, struct lec_conn *c, char *msg) {
+  struct Pkt q;
+
+  memcpy(q.dst,c->addr,6);
+  q.etype = htons(CEC_ETYPE);
+  q.conn = c->conn;
+  if (msg) {
+    q.type = Tdata;
+    q.seq = ++c->seq;
+    q.len = strlen(msg);
+    memcpy(q.data,msg,q.len);
+    lec_send(l,c->ifn,&q,HDRSIZ + q.len);
+  }
+  q.type = Treset;
+  q.seq = 0;
+  q.len = 0;
+  c->last = 0;
+  c->inflight = 0;
+  return lec_send(l,c->ifn,&q,60);
+}
+
+/*
+ * Retransmit frames that were not acked in time and expire idle
+ * clients.  Returns the number of ms until something is due, or -1.
+ */
+long long lec_poll(struct lec *l, long long now) {
+  struct lec_conn *c;
+  long long next = -1, due;
+  time_t t = now / 1000;
+
+  for (c = l->conns; c < l->conns + LEC_MAXCONN; c++) {
+    if (!c->last) continue;
+    if (t - c->last > l->idle) {
+      lec_reset(l,c,NULL);
+      lec_gone(l,c,"timed out");
+      continue;
+    }
+    due = (c->last + l->idle - t + 1) * 1000LL;
+    if (next == -1 || due < next) next = due;
+    if (!c->inflight) continue;
+
+    due = c->sent + LEC_RETRANSMIT - now;
+    if (due <= 0) {
+      if (++c->retries > LEC_RETRIES) {
+	/* cec doesn't ack duplicates, assume it got there */
+	lec_acked(l,c);
+	if (!c->inflight) continue;
+      } else {
+	c->sent = now;
+	lec_send(l,c->ifn,&c->txpkt,HDRSIZ + c->txpkt.len);
+      }
+      due = LEC_RETRANSMIT;
+    }
+    if (due < next) next = due;
+  }
+  return next;
+}
+
+/*
+ * Check that the requested shelf numbers are free and pick free ones
+ * for those set to -1.  Returns -1 if one of them is taken.
+ */
+int lec_assign(int *shelves, int n, int waitsecs) {
+  struct Shelf *s, *r = cec_probe(waitsecs,-1,NULL);
+  int i, j, next = 0;
+
+  for (i = 0; i < n; i++) {
+    if (shelves[i] == -1) continue;
+    for (s=r; s; s = s->next) {
+      if (s->shelfno == shelves[i]) {
+	char aea[16];
+	htoa(aea,s->ea,6);
+	fprintf(stderr,"shelf %d (%s) already exists at %s\n",
+		s->shelfno,s->str,aea);
+	freeprobe(r);
+	return -1;
+      }
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    if (shelves[i] != -1) continue;
+    /* Search for the next unused number */
+    for (;; next++) {
+      for (s=r; s && s->shelfno != next; s = s->next);
+      if (s) continue;
+      for (j = 0; j < n && shelves[j] != next; j++);
+      if (j == n) break;
+    }
+    shelves[i] = next++;
+  }
+  freeprobe(r);
+  return 0;
+}
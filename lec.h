@@ -0,0 +1,94 @@
+/*
+ * Embeddable CEC server (liblec)
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * A "struct lec" is one console as seen from the network: a shelf
+ * number, its address on each interface and the clients attached to
+ * it.  The library never blocks and keeps no global state:
+ *
+ *   - received frames are handed to lec_feed(),
+ *   - lec_poll() runs retransmissions and idle timeouts and says when
+ *     it wants to be called again,
+ *   - frames go out through the send hook, which defaults to the raw
+ *     sockets in system.c,
+ *   - whatever happens to a client is reported through the other
+ *     hooks in struct lec_ops.
+ *
+ * Output to a client is sent one frame at a time; lec_write() fails
+ * while a frame is waiting for its ack and the ready hook is called
+ * once it may be used again.
+ */
+#include <time.h>
+
+enum {
+  LEC_MAXCONN = 4,	/* Clients per console */
+  LEC_IDLE = 300,	/* Default idle timeout in seconds */
+  LEC_RETRANSMIT = 200,	/* ms to wait for an ack */
+  LEC_RETRIES = 5,	/* retransmissions before giving up on a frame */
+};
+
+struct lec;
+
+struct lec_conn {
+  uchar addr[6];
+  int ifn;		/* interface the client is on */
+  time_t last;		/* Last heard from, 0 if the slot is free */
+  uchar conn;
+  uchar seq;		/* Last seq sent */
+  int rseq;		/* Last seq received, -1 if none */
+
+  int inflight;		/* Waiting for an ack for txpkt */
+  int retries;
+  long long sent;	/* When txpkt was (re)sent, in ms */
+  struct Pkt txpkt;
+};
+
+struct lec_ops {
+  /* Put a frame on the wire, NULL for the raw sockets */
+  int (*send)(struct lec *, int ifn, struct Pkt *, int len);
+  /* A client connects, return NULL to accept or why not */
+  char *(*attach)(struct lec *, struct lec_conn *);
+  /* Tdata (keystrokes) or an extension request from a client */
+  void (*input)(struct lec *, struct lec_conn *, int type, uchar *, int);
+  /* The last frame was acked (or given up on) */
+  void (*ready)(struct lec *, struct lec_conn *);
+  /* The client went away or timed out */
+  void (*detach)(struct lec *, struct lec_conn *, char *why);
+};
+
+struct lec {
+  int shelf;
+  char ea[MAX_NETIFS][6];	/* Our address on each interface */
+  int idle;			/* Idle timeout in seconds */
+  struct lec_ops *ops;
+  void *arg;			/* For the application */
+  struct lec_conn conns[LEC_MAXCONN];
+};
+
+void lec_init(struct lec *, int shelf, struct lec_ops *, void *arg);
+void lec_addrs(struct lec *, int n);
+int lec_feed(struct lec *, int ifn, struct Pkt *, int len);
+long long lec_poll(struct lec *, long long now);
+int lec_write(struct lec *, struct lec_conn *, void *, int);
+int lec_reset(struct lec *, struct lec_conn *, char *msg);
+int lec_assign(int *shelves, int n, int waitsecs);
+long long lec_now(void);
@@ -0,0 +1,334 @@
+/*
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *++
+ * = LECBENCH(8)
+ * :Revision: REVISION
+ * :Author: A Liu Ly
+ *
+ * == NAME
+ *
+ * lecbench - Benchmark the CEC protocol over a virtual network
+ *
+ * == SYNOPSIS
+ *
+ * *lecbench* _[options]_
+ *
+ * == DESCRIPTION
+ *
+ * *lecbench* runs a *vhub* switch, a *liblec* server and a CEC
+ * client inside a single process and times the protocol end to end.
+ * Nothing touches a real network, so it needs no privileges and the
+ * results only depend on the code and the machine.
+ *
+ * The client discovers the server, connects and then measures:
+ *
+ * - *connect*: from the discovery broadcast to the connection being
+ *   established.
+ * - *echo*: keystrokes sent one at a time, timed until the server's
+ *   echo of each arrives.
+ * - *stream*: goodput of the server sending output as fast as the
+ *   client acks it.
+ *
+ * == OPTIONS
+ *
+ * * *-b* _bytes_::
+ *   Bytes to stream, 1M by default.
+ * * *-d*::
+ *   Dump every frame.
+ * * *-n* _keys_::
+ *   Keystrokes to echo, 1000 by default.
+ * * *-p* _path_::
+ *   Where to create the hub socket, a file under /tmp by default.
+ * * *-v*::
+ *   Print version and exit.
+ *
+ * == SEE ALSO
+ *
+ * *vhub(8)*
+ *
+ * == AUTHORS
+ *
+ * - Alejandro Liu Ly
+ *--
+ */
+#include "cec.h"
+#include "lec.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef VERSION
+#define VERSION "0.00"
+#endif
+
+enum {
+  CL_TIMEOUT = 2000,	/* ms the client waits for anything */
+};
+
+int debug = 0;
+char *progname = "lecbench";
+
+int hubfd = -1, clfd = -1;
+char hubpath[108];
+uchar clea[6] = { 0x02, 0xfe, 0, 0, 0, 1 };
+struct lec srv;
+
+long long stream_left;
+
+void usage(void) {
+  fprintf(stderr,"Usage:\n\t%s [-d][-b bytes][-n keys][-p path][-v]\n",
+	  progname);
+  exit(1);
+}
+
+long long usecs(void) {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void cleanup(void) {
+  if (hubpath[0]) unlink(hubpath);
+}
+
+/*
+ * The server: echo keystrokes, a "!s" starts the stream
+ */
+void srv_stream(struct lec *l, struct lec_conn *c) {
+  struct Pkt *q = &c->txpkt;
+  int n = stream_left > MAX_PAYLOAD ? MAX_PAYLOAD : stream_left;
+
+  if (n <= 0) return;
+  memset(q->data,'x',n);
+  if (lec_write(l,c,q->data,n) > 0) stream_left -= n;
+}
+
+void srv_input(struct lec *l, struct lec_conn *c, int type, uchar *data, int len) {
+  if (len == 2 && memcmp(data,"!s",2) == 0) {
+    srv_stream(l,c);
+    return;
+  }
+  lec_write(l,c,data,len);
+}
+
+static struct lec_ops bench_ops = {
+  .input = srv_input,
+  .ready = srv_stream,
+};
+
+void srv_data(fd_set *rfds) {
+  struct Pkt q;
+  int n;
+
+  while (netrecvset(rfds) > 0) {
+    if ((n = netget(&q,sizeof q)) > 0) lec_feed(&srv,netifn,&q,n);
+  }
+}
+
+/*
+ * The client: a bare CEC implementation on its own vnet port
+ */
+void cl_open(void) {
+  struct sockaddr_un sa;
+
+  clfd = socket(AF_UNIX,SOCK_DGRAM,0);
+  if (clfd == -1) fatal("socket");
+  memset(&sa,0,sizeof sa);
+  sa.sun_family = AF_UNIX;
+  if (bind(clfd,(struct sockaddr *)&sa,sizeof(sa_family_t)) == -1)
+    fatal("bind");
+  strcpy(sa.sun_path,hubpath);
+  if (connect(clfd,(struct sockaddr *)&sa,sizeof sa) == -1)
+    fatal(hubpath);
+}
+
+void cl_send(uchar *dst, int type, int conn, int seq, void *data, int len) {
+  struct Pkt p;
+
+  memset(&p,0,sizeof p);
+  memcpy(p.dst,dst,6);
+  memcpy(p.src,clea,6);
+  p.etype = htons(CEC_ETYPE);
+  p.type = type;
+  p.conn = conn;
+  p.seq = seq;
+  p.len = len;
+  if (len) memcpy(p.data,data,len);
+  if (debug) {
+    printf("client sends %d bytes\n",HDRSIZ + len);
+    dump((char *)&p,HDRSIZ + len);
+  }
+  if (write(clfd,&p,HDRSIZ + len < 60 ? 60 : HDRSIZ + len) == -1)
+    fatal("client write");
+}
+
+/*
+ * Run the hub and the server until the client gets a frame
+ */
+int cl_recv(struct Pkt *p) {
+  long long deadline = lec_now() + CL_TIMEOUT, now, next;
+  struct timeval tv;
+  fd_set rfds;
+  int maxfd, n;
+
+  for (;;) {
+    now = lec_now();
+    if (now >= deadline) return 0;
+    next = lec_poll(&srv,now);
+    if (next == -1 || next > deadline - now) next = deadline - now;
+    tv.tv_sec = next / 1000;
+    tv.tv_usec = (next % 1000) * 1000;
+
+    FD_ZERO(&rfds);
+    FD_SET(hubfd,&rfds);
+    FD_SET(clfd,&rfds);
+    maxfd = netfds(&rfds,hubfd > clfd ? hubfd : clfd);
+    n = select(maxfd+1,&rfds,NULL,NULL,&tv);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      fatal("select");
+    }
+    if (n == 0) continue;
+    if (FD_ISSET(hubfd,&rfds) && vhub_input(hubfd) == -1) fatal("vhub");
+    srv_data(&rfds);
+    if (FD_ISSET(clfd,&rfds)) {
+      n = read(clfd,p,sizeof *p);
+      if (n == -1) fatal("client read");
+      if (n < 60 || ntohs(p->etype) != CEC_ETYPE) continue;
+      if (memcmp(p->dst,clea,6) != 0) continue;
+      return n;
+    }
+  }
+}
+
+int cmp_ll(const void *a, const void *b) {
+  long long x = *(long long *)a, y = *(long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc,char **argv) {
+  uchar srvea[6], bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  long long bytes = 1 << 20, got, t0, t1, total, *lat;
+  int keys = 1000, ch, i, seq = 0, rseq = -1, frames;
+  char ifname[128], key;
+  struct Pkt p;
+
+  progname = argv[0];
+  snprintf(hubpath,sizeof hubpath,"/tmp/lecbench.%d",(int)getpid());
+  while ((ch=getopt(argc,argv,"b:dn:p:v?")) != -1) {
+    switch (ch) {
+    case 'b':
+      bytes = parsesize(optarg);
+      break;
+    case 'd':
+      debug++;
+      break;
+    case 'n':
+      keys = atoi(optarg);
+      break;
+    case 'p':
+      snprintf(hubpath,sizeof hubpath,"%s",optarg);
+      break;
+    case 'v':
+      printf("%s v%s\n",progname,VERSION);
+      exit(0);
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || keys < 1 || bytes < 0) usage();
+
+  hubfd = vhub_open(hubpath);
+  if (hubfd == -1) exit(1);
+  atexit(cleanup);
+  snprintf(ifname,sizeof ifname,"vnet:%s",hubpath);
+  if (netopen(ifname)) fatal("netopen");
+  lec_init(&srv,1,&bench_ops,NULL);
+  lec_addrs(&srv,0);
+  cl_open();
+
+  /* Find the server and connect to it */
+  t0 = usecs();
+  cl_send(bcast,Tdiscover,0,0,NULL,0);
+  do {
+    if (!cl_recv(&p)) fatal("no offer");
+  } while (p.type != Toffer);
+  memcpy(srvea,p.src,6);
+  cl_send(srvea,Tinita,1,0,NULL,0);
+  do {
+    if (!cl_recv(&p)) fatal("no Tinitb");
+  } while (p.type != Tinitb);
+  cl_send(srvea,Tinitc,1,0,NULL,0);
+  t1 = usecs();
+  printf("connect  %8.3f ms\n",(t1 - t0) / 1000.0);
+
+  /* Keystroke echo */
+  lat = calloc(keys,sizeof *lat);
+  if (lat == NULL) fatal("calloc");
+  for (i = 0; i < keys; i++) {
+    key = 'a' + i % 26;
+    t0 = usecs();
+    cl_send(srvea,Tdata,1,++seq,&key,1);
+    for (;;) {
+      if (!cl_recv(&p)) fatal("no echo");
+      if (p.type != Tdata) continue;
+      cl_send(srvea,Tack,1,p.seq,NULL,0);
+      if (p.seq == rseq) continue;
+      rseq = p.seq;
+      break;
+    }
+    lat[i] = usecs() - t0;
+  }
+  qsort(lat,keys,sizeof *lat,cmp_ll);
+  for (total = i = 0; i < keys; i++) total += lat[i];
+  printf("echo     %8d keys   avg %lld us  p50 %lld us  p99 %lld us\n",
+	 keys,total / keys,lat[keys / 2],lat[keys * 99 / 100]);
+  free(lat);
+
+  /* Bulk output */
+  stream_left = bytes;
+  got = frames = 0;
+  t0 = usecs();
+  cl_send(srvea,Tdata,1,++seq,"!s",2);
+  while (got < bytes) {
+    if (!cl_recv(&p)) fatal("stream stalled");
+    if (p.type != Tdata) continue;
+    cl_send(srvea,Tack,1,p.seq,NULL,0);
+    if (p.seq == rseq) continue;
+    rseq = p.seq;
+    got += p.len;
+    frames++;
+  }
+  t1 = usecs();
+  printf("stream   %8lld bytes  %.3f s  %.2f MB/s  %d frames\n",
+	 got,(t1 - t0) / 1e6,got / ((t1 - t0) / 1e6) / (1 << 20),frames);
+
+  cl_send(srvea,Treset,1,0,NULL,0);
+  printf("hub      %8lu in  %lu out  %lu dropped\n",
+	 vhub_stats.frames_in,vhub_stats.frames_out,vhub_stats.drops);
+  return 0;
+}
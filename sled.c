@@ -35,20 +35,26 @@
  * The *sled* command uses raw sockets to connect to present CEC compatible
  * server for console access.  All clients share the same session.
  *
- * It does this by spawning a couple of process, one to manage
- * a PTY and another to manage an Ethernet Console by exec'ing the
- * *ec-drv* command.
+ * It does this by creating a PTY and spawning a single process that
+ * serves it to Ethernet Console Clients and copies it to and from the
+ * physical console.  This process runs the same server as *ec-drv*,
+ * so the PTY, the physical console and the network are all handled
+ * in one event loop.
  *
  * After that is done, then it will arrange for *init* to replace
  * it as the INIT process, however, any processes spawned from
  * that point on will have the PTY as its controlling terminal.
  *
- * I/O from the PTY is then send to Ethernet Console Clients.
+ * With *-e*, *sled* instead spawns a process to manage the PTY and
+ * another one that exec's the given *ec-drv* command.  The PTY
+ * output is then duplicated to *ec-drv* and to the physical console
+ * inside the kernel with *splice(2)* and *tee(2)*, falling back to
+ * plain reads and writes where that is not supported.
  *
  * == OPTIONS
  *
  * * *-e* _ec-drv_::
- *   Path to the *ec-drv* command.
+ *   Use an external *ec-drv* command instead of the built-in server.
  * * *-i* _secs_::
  *   Disconnect sesions that have been inactive for more than _secs_
  *   seconds.
@@ -71,7 +77,7 @@
  *--
  */
 
-
+#define _GNU_SOURCE	/* for splice() and tee() */
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -83,6 +89,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include "cec.h"
+#include "ec-srv.h"
 
 
 #ifndef VERSION
@@ -90,10 +97,8 @@
 #endif
 
 char *progname = "sled";
-char *lecdcmd = "/sbin/ec-drv";
-char *shelf= NULL;
-char *waitsecs = NULL;
-char *idle_timer = NULL;
+char *lecdcmd = NULL;
+int shelf = -1;
 int debug = 0;
 
 int ptyfd;	/* Pty pair */
@@ -144,8 +149,177 @@ int compat_getpty(int *ptyfd,int *slave) {
   return -1;
 }
 
+/*
+ * Copy console output to ec-drv and to our own stdout.  The output is
+ * spliced into a pipe and duplicated there with tee(), so it never
+ * goes through user space.  If the kernel can't splice one of the
+ * descriptors we fall back to read() and write().
+ */
+void con_output(int ptyfd, int netout) {
+  static int mid[2] = { -1, -1 };
+  static int zcopy = 1, outsplice = 1;
+  char buf[1024];
+  ssize_t i, t, o;
+
+  if (zcopy && mid[0] == -1 && pipe(mid) == -1) {
+    perror("pipe(splice)");
+    zcopy = 0;
+  }
+  if (zcopy) {
+    i = splice(ptyfd,NULL,mid[1],NULL,4096,SPLICE_F_MOVE);
+    if (i == -1 && errno == EINVAL)
+      zcopy = 0;
+    else if (i <= 0)
+      fatal("I/O error reading pty");
+  }
+  if (!zcopy) {
+    i = read(ptyfd,buf,sizeof buf);
+    if (i <= 0) fatal("I/O error reading pty");
+    write(netout,buf,i);
+    write(STDOUT_FILENO,buf,i);
+    return;
+  }
+
+  while (i > 0) {
+    t = tee(mid[0],netout,i,0);
+    if (t == -1) {
+      if (errno == EINTR) continue;
+      fatal("tee");
+    }
+    i -= t;
+    /* tee() doesn't consume, so move what went to ec-drv to stdout */
+    while (t > 0) {
+      o = -1;
+      if (outsplice) {
+	o = splice(mid[0],NULL,STDOUT_FILENO,NULL,t,SPLICE_F_MOVE);
+	if (o == -1 && errno != EINTR) outsplice = 0;
+      }
+      if (!outsplice) {
+	o = read(mid[0],buf,t > sizeof buf ? sizeof buf : t);
+	if (o <= 0) fatal("read(splice)");
+	write(STDOUT_FILENO,buf,o);
+      }
+      if (o > 0) t -= o;
+    }
+  }
+}
+
+/*
+ * Serve the pty from this process
+ */
+void serve(char *eth) {
+  struct console *con;
+  char c;
+
+  close(slave);
+  if (setsid()==-1) perror("setsid(sled)");
+
+  con = new_console(shelf,"pty");
+  if (netup(eth)) fatal("netup");
+  if (netopen(eth)) fatal("netopen");
+  srv_init();
+
+  con->ifd = con->ofd = ptyfd;
+  lconsole = 1;		/* The physical console */
+  localfd = STDOUT_FILENO;
+
+  write(ptyfd,"\n",1);	/* Tell peer that we are ready ... */
+  read(ptyfd,&c,1);	/* Wait for peer to reply ready... */
+
+  rawon();
+  con_server();
+}
+
+/*
+ * Run a CON driver and an external ec-drv (see -e)
+ */
+void ec_drv(char *eth) {
+  /* Start a CON driver and ETH driver processes */
+  int io1[2], io2[2];
+  pid_t mpid;
+
+  if (pipe(io1) == -1) fatal("pipe1");
+  if (pipe(io2) == -1) fatal("pipe2");
+
+  if ((mpid = fork()) == -1) fatal("fork");    
+  if (!mpid) {
+    char *lecd_cmdline[20], sbuf[16], wbuf[16], ibuf[16];
+    int j;
+    /* This is the network driver process */
+
+    /* child process... */
+    close(slave);
+    close(ptyfd);
+
+    dup2(io1[0],STDIN_FILENO); close(io1[1]);
+    dup2(io2[1],STDOUT_FILENO); close(io2[0]);
+
+    write(STDOUT_FILENO,"\n",1); /* Tell peer that we are ready ... */
+    read(STDIN_FILENO,&j,1); /* Wait for peer to reply ready... */
+    close(ptyfd);
+    if (setsid()==-1) perror("setsid(lec)");
+
+    j = 0;
+    lecd_cmdline[j++] = "lecd";
+    if (shelf != -1) {
+      snprintf(sbuf,sizeof sbuf,"%d",shelf);
+      lecd_cmdline[j++] = "-s";
+      lecd_cmdline[j++] = sbuf;
+    }
+    snprintf(wbuf,sizeof wbuf,"%d",waitsecs);
+    lecd_cmdline[j++] = "-w";
+    lecd_cmdline[j++] = wbuf;
+    snprintf(ibuf,sizeof ibuf,"%d",idle_timer);
+    lecd_cmdline[j++] = "-i";
+    lecd_cmdline[j++] = ibuf;
+    lecd_cmdline[j++] = eth;
+    lecd_cmdline[j++] = NULL;
+    
+    execvp(lecdcmd,lecd_cmdline);
+    fatal("exec");
+  } else {
+    int maxfd = 0;
+    fd_set rfds;
+    int i;
+    char buf[1024];
+
+    // This is the CON driver process
+    close(io1[0]);close(io2[1]);
+    close(slave);
+
+
+    if (STDIN_FILENO > maxfd) maxfd = STDIN_FILENO;
+    if (ptyfd > maxfd) maxfd = ptyfd;
+    if (io2[0] > maxfd) maxfd = io2[0];
+    ++maxfd;
+    
+    rawon();
+    // fprintf(stderr,"%d: ENTER MAIN LOOP\n",getpid());
+    for (;;) {
+      FD_ZERO(&rfds);
+      FD_SET(STDIN_FILENO,&rfds);
+      FD_SET(ptyfd,&rfds);
+      FD_SET(io2[0],&rfds);
+      select(maxfd,&rfds,NULL,NULL,NULL);
+      if (FD_ISSET(ptyfd,&rfds))
+	con_output(ptyfd,io1[1]);
+      if (FD_ISSET(STDIN_FILENO,&rfds)) {
+	i = read(STDIN_FILENO,buf,sizeof buf);
+	if (i <= 0) fatal("I/O error reading pty");
+	write(ptyfd,buf,i);
+      }
+
+      if (FD_ISSET(io2[0],&rfds)) {
+	i = read(io2[0],buf,sizeof buf);
+	if (i <= 0) fatal("I/O error reading pty");
+	write(ptyfd,buf,i);
+      }
+    }
+  }
+}
+
 void usage(void) {
-  fprintf(stderr,"Usage:\n\t%s [-e lecd][-w wait][-s shelf][-v][-?] eth cmd\n",
+  fprintf(stderr,"Usage:\n\t%s [-e ec-drv][-i secs][-w wait][-s shelf][-v][-?] eth cmd\n",
 	  progname);
   exit(1);
 }
@@ -162,25 +336,25 @@ int main(int argc,char **argv) {
       lecdcmd = optarg;
       break;
     case 'i':
-      if (atoi(optarg) <= 0) {
+      idle_timer = atoi(optarg);
+      if (idle_timer <= 0) {
 	fputs("invalid i value, ignoring.\n",stderr);
-	idle_timer = NULL;
-      } else
-	idle_timer = optarg;
+	idle_timer = IDLE_TIMER;
+      }
       break;
     case 's':
-      shelf = optarg;
+      shelf = atoi(optarg);
       break;
     case 'v':
       printf("%s v%s\n",progname,VERSION);
       exit(0);
       break;
     case 'w':
-      if (atoi(optarg) <= 0) {
+      waitsecs = atoi(optarg);
+      if (waitsecs <= 0) {
 	fputs("Invalid w value, ignoring.\n",stderr);
-	waitsecs = NULL;
-      } else 
-	waitsecs = optarg;
+	waitsecs = WAITSECS;
+      }
       break;
     case '?':
     default:
@@ -198,91 +372,10 @@ int main(int argc,char **argv) {
 
   if ((mpid = fork()) == -1) fatal("fork");
   if (!mpid) {
-    /* Start a CON driver and ETH driver processes */
-    int io1[2], io2[2];
-    if (pipe(io1) == -1) fatal("pipe1");
-    if (pipe(io2) == -1) fatal("pipe2");
-
-    if ((mpid = fork()) == -1) fatal("fork");    
-    if (!mpid) {
-      char *lecd_cmdline[20];
-      int j;
-      /* This is the network driver process */
-
-      /* child process... */
-      close(slave);
-      close(ptyfd);
-
-      dup2(io1[0],STDIN_FILENO); close(io1[1]);
-      dup2(io2[1],STDOUT_FILENO); close(io2[0]);
-
-      write(STDOUT_FILENO,"\n",1); /* Tell peer that we are ready ... */
-      read(STDIN_FILENO,&j,1); /* Wait for peer to reply ready... */
-      close(ptyfd);
-      if (setsid()==-1) perror("setsid(lec)");
-
-      j = 0;
-      lecd_cmdline[j++] = "lecd";
-      if (shelf) {
-	lecd_cmdline[j++] = "-s";
-	lecd_cmdline[j++] = shelf;
-      }
-      if (waitsecs) {
-	lecd_cmdline[j++] = "-w";
-	lecd_cmdline[j++] = waitsecs;
-      }
-      if (idle_timer) {
-	lecd_cmdline[j++] = "-i";
-	lecd_cmdline[j++] = idle_timer;
-      }
-      lecd_cmdline[j++] = argv[0];
-      lecd_cmdline[j++] = NULL;
-      
-      execvp(lecdcmd,lecd_cmdline);
-      fatal("exec");
-    } else {
-      int maxfd = 0;
-      fd_set rfds;
-      int i;
-      char buf[1024];
-
-      // This is the CON driver process
-      close(io1[0]);close(io2[1]);
-      close(slave);
-
-
-      if (STDIN_FILENO > maxfd) maxfd = STDIN_FILENO;
-      if (ptyfd > maxfd) maxfd = ptyfd;
-      if (io2[0] > maxfd) maxfd = io2[0];
-      ++maxfd;
-      
-      rawon();
-      // fprintf(stderr,"%d: ENTER MAIN LOOP\n",getpid());
-      for (;;) {
-	FD_ZERO(&rfds);
-	FD_SET(STDIN_FILENO,&rfds);
-	FD_SET(ptyfd,&rfds);
-	FD_SET(io2[0],&rfds);
-	select(maxfd,&rfds,NULL,NULL,NULL);
-	if (FD_ISSET(ptyfd,&rfds)) {
-	  i = read(ptyfd,buf,sizeof buf);
-	  if (i <= 0) fatal("I/O error reading pty");
-	  write(io1[1],buf,i);
-	  write(STDOUT_FILENO,buf,i);
-	}
-	if (FD_ISSET(STDIN_FILENO,&rfds)) {
-	  i = read(STDIN_FILENO,buf,sizeof buf);
-	  if (i <= 0) fatal("I/O error reading pty");
-	  write(ptyfd,buf,i);
-	}
-
-	if (FD_ISSET(io2[0],&rfds)) {
-	  i = read(io2[0],buf,sizeof buf);
-	  if (i <= 0) fatal("I/O error reading pty");
-	  write(ptyfd,buf,i);
-	}
-      }
-    }
+    if (lecdcmd)
+      ec_drv(argv[0]);
+    else
+      serve(argv[0]);
   } else {
     /* Init driver... */
     const char devtty[] = "/dev/tty";
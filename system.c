@@ -23,6 +23,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -48,10 +49,15 @@
 #include "cec.h"
 
 extern int debug;
-int netfd;
+int netfd;			/* fd of the first interface (compat) */
+int netifn;			/* interface of the last frame received */
+int nnetifs;
+struct Netif netifs[MAX_NETIFS];
 char net_bytes[1<<14];
 int net_len;
-char srcaddr[6];
+char srcaddr[6];		/* hw address of the first interface */
+
+static int netmember(struct Netif *, char *);
 
 int
 getindx(int s, char *name)	// return the index of device 'name'
@@ -67,53 +73,307 @@ getindx(int s, char *name)	// return the index of device 'name'
 }
 
 int netclose(void) {
-  return close(netfd);
+  int i, rr = 0;
+
+  for (i = 0; i < nnetifs; i++) {
+    if (netifs[i].fd == -1) continue;
+    if (close(netifs[i].fd)) rr = -1;
+    netifs[i].fd = -1;
+  }
+  return rr;
 }
 
+/*
+ * Attach to a virtual ethernet hub (see vhub(8)).  Frames are
+ * datagrams on an AF_UNIX socket and the hub forwards them like a
+ * learning switch.  The address is made up from our pid.
+ */
+static int
+vnetbind(struct Netif *nif)
+{
+	struct sockaddr_un sa;
+	int fd, pid = getpid();
 
-int
-netopen(char *eth)		// get us a raw connection to an interface
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		perror("vnet socket");
+		return -1;
+	}
+	/* Let the kernel pick a name so the hub can answer us */
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa_family_t)) == -1) {
+		perror("vnet bind");
+		close(fd);
+		return -1;
+	}
+	if (strlen(nif->name + 5) >= sizeof sa.sun_path) {
+		fprintf(stderr, "%s: path too long\n", nif->name);
+		close(fd);
+		return -1;
+	}
+	strcpy(sa.sun_path, nif->name + 5);
+	if (connect(fd, (struct sockaddr *)&sa, sizeof sa) == -1) {
+		perror(nif->name);
+		close(fd);
+		return -1;
+	}
+	write(fd, "", 0);	/* say hello to the hub */
+	nif->vnet = 1;
+	nif->index = nif - netifs;
+	nif->addr[0] = 0x02;
+	nif->addr[1] = nif->index;
+	nif->addr[2] = pid >> 24;
+	nif->addr[3] = pid >> 16;
+	nif->addr[4] = pid >> 8;
+	nif->addr[5] = pid;
+	nif->fd = fd;
+	return 0;
+}
+
+/*
+ * A hub floods frames it doesn't know where to send, so drop the ones
+ * that a real interface would have filtered out.
+ */
+static int
+vnetmine(struct Netif *nif, uchar *dst)
 {
-	int i, n;
+	int i;
+
+	if (dst[0] & 1 || memcmp(dst, nif->addr, 6) == 0)
+		return 1;
+	for (i = 0; i < nif->nucast; i++)
+		if (memcmp(dst, nif->ucast + 6*i, 6) == 0)
+			return 1;
+	return 0;
+}
+
+static int
+netbind(struct Netif *nif)	// get us a raw connection to an interface
+{
+	int fd, n;
 	struct sockaddr_ll sa;
 	struct ifreq xx;
 
+	if (strncmp(nif->name, "vnet:", 5) == 0)
+		return vnetbind(nif);
+	if (strlen(nif->name) >= IFNAMSIZ) {
+		fprintf(stderr, "invalid interface name: %s\n", nif->name);
+		return -1;
+	}
+
 	memset(&sa, 0, sizeof sa);
-	netfd = socket(PF_PACKET, SOCK_RAW, htons(CEC_ETYPE));
-	if (netfd == -1) {
+	fd = socket(PF_PACKET, SOCK_RAW, htons(CEC_ETYPE));
+	if (fd == -1) {
 		perror("got bad socket");
 		return -1;
 	}
-	i = getindx(netfd, eth);
+	nif->index = getindx(fd, nif->name);
 	sa.sll_family = AF_PACKET;
 	sa.sll_protocol = htons(CEC_ETYPE);
-	sa.sll_ifindex = i;
-	n = bind(netfd, (struct sockaddr *)&sa, sizeof sa);
+	sa.sll_ifindex = nif->index;
+	n = bind(fd, (struct sockaddr *)&sa, sizeof sa);
 	if (n == -1) {
 		perror("bind funky");
+		close(fd);
 		return -1;
 	}
-        strcpy(xx.ifr_name, eth);
-	n = ioctl(netfd, SIOCGIFHWADDR, &xx);
+        strcpy(xx.ifr_name, nif->name);
+	n = ioctl(fd, SIOCGIFHWADDR, &xx);
 	if (n == -1) {
 		perror("Can't get hw addr");
+		close(fd);
 		return -1;
 	}
-	memmove(srcaddr, xx.ifr_hwaddr.sa_data, 6);
+	memmove(nif->addr, xx.ifr_hwaddr.sa_data, 6);
+	nif->fd = fd;
+	for (n = 0; n < nif->nucast; n++)
+		netmember(nif, nif->ucast + 6*n);
 	return 0;
 }
 
+/*
+ * Ask the interface to pass up frames for an additional unicast
+ * address.  If the driver can't filter on it, fall back to
+ * promiscuous mode.
+ */
+static int
+netmember(struct Netif *nif, char *ea)
+{
+	struct packet_mreq mr;
+
+	if (nif->vnet)
+		return 0;	/* see vnetmine() */
+	memset(&mr, 0, sizeof mr);
+	mr.mr_ifindex = nif->index;
+	mr.mr_type = PACKET_MR_UNICAST;
+	mr.mr_alen = 6;
+	memcpy(mr.mr_address, ea, 6);
+	if (setsockopt(nif->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+		       &mr, sizeof mr) == 0)
+		return 0;
+	mr.mr_type = PACKET_MR_PROMISC;
+	mr.mr_alen = 0;
+	memset(mr.mr_address, 0, sizeof mr.mr_address);
+	if (setsockopt(nif->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+		       &mr, sizeof mr) == 0)
+		return 0;
+	perror("PACKET_ADD_MEMBERSHIP");
+	return -1;
+}
+
+/*
+ * Also receive frames sent to "ea" on interface ifn.  Remembered so
+ * that netreopen() can restore it.
+ */
 int
-netrecv(void)
+netaddmac(int ifn, char *ea)
 {
-	net_len = read(netfd, net_bytes, sizeof net_bytes);
+	struct Netif *nif = &netifs[ifn];
+	char *p;
+
+	p = realloc(nif->ucast, 6 * (nif->nucast+1));
+	if (p == NULL)
+		return -1;
+	nif->ucast = p;
+	memcpy(nif->ucast + 6 * nif->nucast++, ea, 6);
+	return netmember(nif, ea);
+}
+
+/*
+ * Open one or more interfaces.  "eth" may be a comma separated list,
+ * (e.g. "eth0,eth1") in which case frames are received from all of
+ * them and replies go out on the interface the request came from.
+ */
+int
+netopen(char *eth)
+{
+	char *p, *q;
+	struct Netif *nif;
+
+	for (p = eth; *p; p = q) {
+		q = strchr(p, ',');
+		if (q == NULL)
+			q = p + strlen(p);
+		if (q - p == 0 || q - p >= sizeof nif->name) {
+			fprintf(stderr, "invalid interface name: %s\n", eth);
+			return -1;
+		}
+		if (nnetifs == MAX_NETIFS) {
+			fprintf(stderr, "too many interfaces: %s\n", eth);
+			return -1;
+		}
+		nif = &netifs[nnetifs];
+		memset(nif, 0, sizeof *nif);
+		memcpy(nif->name, p, q - p);
+		if (netbind(nif))
+			return -1;
+		nnetifs++;
+		if (*q)
+			q++;
+	}
+	if (nnetifs == 0)
+		return -1;
+	netfd = netifs[0].fd;
+	memmove(srcaddr, netifs[0].addr, 6);
+	return 0;
+}
+
+/*
+ * Re-open an interface that went away (i.e. ENETDOWN)
+ */
+int
+netreopen(int ifn)
+{
+	struct Netif *nif = &netifs[ifn];
+
+	if (nif->fd != -1)
+		close(nif->fd);
+	nif->fd = -1;
+	if (!nif->vnet && netup(nif->name))
+		return -1;
+	if (netbind(nif))
+		return -1;
+	if (ifn == 0) {
+		netfd = nif->fd;
+		memmove(srcaddr, nif->addr, 6);
+	}
+	return 0;
+}
+
+/*
+ * Add the interface fds to a select set
+ */
+int
+netfds(fd_set *rfds, int maxfd)
+{
+	int i;
+
+	for (i = 0; i < nnetifs; i++) {
+		FD_SET(netifs[i].fd, rfds);
+		if (netifs[i].fd > maxfd)
+			maxfd = netifs[i].fd;
+	}
+	return maxfd;
+}
+
+static int
+netread(int ifn)
+{
+	netifn = ifn;
+	net_len = read(netifs[ifn].fd, net_bytes, sizeof net_bytes);
+	if (netifs[ifn].vnet && net_len >= 6
+	    && !vnetmine(&netifs[ifn], (uchar *)net_bytes))
+		return net_len = 0;
 	if (debug) {
-		printf("read %d bytes\r\n", net_len);
+		printf("read %d bytes (%s)\r\n", net_len, netifs[ifn].name);
 		dump(net_bytes, net_len);
 	}
 	return net_len;
 }
 
+/*
+ * Read a frame from whichever interface flagged in rfds is ready.  The
+ * bit is cleared, so calling it again picks the next one.  Returns 0
+ * if no interface was ready.
+ */
+int
+netrecvset(fd_set *rfds)
+{
+	int i;
+
+	for (i = 0; i < nnetifs; i++) {
+		if (!FD_ISSET(netifs[i].fd, rfds))
+			continue;
+		FD_CLR(netifs[i].fd, rfds);
+		return netread(i);
+	}
+	return 0;
+}
+
+int
+netrecv(void)
+{
+	static int next;
+	fd_set rfds;
+	int i, maxfd;
+
+	if (nnetifs == 1)
+		return netread(0);
+
+	FD_ZERO(&rfds);
+	maxfd = netfds(&rfds, -1);
+	if (select(maxfd+1, &rfds, NULL, NULL, NULL) == -1)
+		return net_len = -1;
+	/* Round robin so a busy interface can't starve the others */
+	for (i = 0; i < nnetifs; i++) {
+		next = (next + 1) % nnetifs;
+		if (FD_ISSET(netifs[next].fd, &rfds))
+			return netread(next);
+	}
+	return net_len = 0;
+}
+
 int
 netget(void *ap, int len)
 {
@@ -126,17 +386,43 @@ netget(void *ap, int len)
 	return len;
 }
 
+/*
+ * Send a frame on interface ifn, or on all of them if ifn is NETIF_ALL.
+ * The source address is "src", or the interface's own if NULL.
+ */
 int
-netsend(void *p, int len)
+netsendas(int ifn, char *src, void *p, int len)
 {
-	memcpy(p+6, srcaddr, 6);
+	int i, n = -1;
+
+	if (ifn == NETIF_ALL) {
+		for (i = 0; i < nnetifs; i++)
+			n = netsendas(i, src, p, len);
+		return n;
+	}
+	memcpy(p+6, src ? src : netifs[ifn].addr, 6);
 	if (debug) {
-		printf("sending %d bytes\r\n", len);
+		printf("sending %d bytes (%s)\r\n", len, netifs[ifn].name);
 		dump(p, len);
 	}
 	if (len < 60)
 		len = 60;
-	return write(netfd, p, len);
+	return write(netifs[ifn].fd, p, len);
+}
+
+int
+netsendif(int ifn, void *p, int len)
+{
+	return netsendas(ifn, NULL, p, len);
+}
+
+/*
+ * Send a frame on the interface the last frame came in from
+ */
+int
+netsend(void *p, int len)
+{
+	return netsendif(netifn, p, len);
 }
 
 
@@ -167,10 +453,23 @@ int _netup(int fd,char *eth) {
   return 0;
 }
 
+/* "eth" may be a comma separated list as in netopen() */
 int netup(char *eth) {
-  int rr, fd = socket(AF_INET,SOCK_DGRAM,IPPROTO_IP);
+  char name[IFNAMSIZ], *p, *q;
+  int rr = 0, fd = socket(AF_INET,SOCK_DGRAM,IPPROTO_IP);
   if (fd == -1) return -1;
-  rr = _netup(fd,eth);
+  for (p = eth; *p && !rr; p = *q ? q+1 : q) {
+    q = strchr(p, ',');
+    if (q == NULL) q = p + strlen(p);
+    if (strncmp(p,"vnet:",5) == 0) continue;
+    if (q - p >= sizeof name) {
+      rr = -1;
+      break;
+    }
+    memcpy(name,p,q-p);
+    name[q-p] = 0;
+    rr = _netup(fd,name);
+  }
   close(fd);
   return rr;
 }
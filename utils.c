@@ -125,6 +125,24 @@ unq:
 	goto loop;
 }
 
+/*
+ * Parse a size with an optional k, m or g suffix.  Returns -1 on error.
+ */
+long long parsesize(char *s) {
+  char *p;
+  long long n = strtoll(s,&p,10);
+
+  if (p == s || n < 0) return -1;
+  switch (*p) {
+  case 'g': case 'G': n <<= 10;
+  case 'm': case 'M': n <<= 10;
+  case 'k': case 'K': n <<= 10;
+    p++;
+  }
+  if (*p) return -1;
+  return n;
+}
+
 void fatal(char *s) {
   perror(s);
   exit(1);
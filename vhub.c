@@ -0,0 +1,104 @@
+/*
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *++
+ * = VHUB(8)
+ * :Revision: REVISION
+ * :Author: A Liu Ly
+ *
+ * == NAME
+ *
+ * vhub - Virtual Ethernet hub for testing
+ *
+ * == SYNOPSIS
+ *
+ * *vhub* _[-d]_ _path_
+ *
+ * == DESCRIPTION
+ *
+ * *vhub* creates a UNIX domain socket at _path_ that behaves like an
+ * Ethernet switch.  Any of the LEC programs given _vnet:path_ instead
+ * of an interface name exchange their frames through it, so clients
+ * and servers can be run and tested without root privileges or a
+ * real network:
+ *
+ *    vhub /tmp/lan &
+ *    ecdrv vnet:/tmp/lan -- /bin/sh &
+ *    cec vnet:/tmp/lan
+ *
+ * Each program gets a made up address and only sees the frames a
+ * real interface would have passed up to it.
+ *
+ * == OPTIONS
+ *
+ * * *-d*::
+ *   Show ports as they come and go.
+ * * *-v*::
+ *   Print version and exit.
+ *
+ * == SEE ALSO
+ *
+ * *cec(8)*, *ec-drv(8)*, *lecd(8)*
+ *
+ * == AUTHORS
+ *
+ * - Alejandro Liu Ly
+ *--
+ */
+#include "cec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef VERSION
+#define VERSION "0.00"
+#endif
+
+int debug = 0;
+char *progname = "vhub";
+
+void usage(void) {
+  fprintf(stderr,"Usage:\n\t%s [-d][-v] path\n",progname);
+  exit(1);
+}
+
+int main(int argc,char **argv) {
+  int ch, fd;
+
+  progname = argv[0];
+  while ((ch=getopt(argc,argv,"dv?")) != -1) {
+    switch (ch) {
+    case 'd':
+      debug++;
+      break;
+    case 'v':
+      printf("%s v%s\n",progname,VERSION);
+      exit(0);
+    default:
+      usage();
+    }
+  }
+  if (optind + 1 != argc) usage();
+
+  fd = vhub_open(argv[optind]);
+  if (fd == -1) exit(1);
+  for (;;) {
+    if (vhub_input(fd) == -1) fatal("vhub");
+  }
+}
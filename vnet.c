@@ -0,0 +1,190 @@
+/*
+ * Virtual ethernet hub
+ *
+ * Linux Ethernet Console
+ *
+ * Copyright (C) 2009-2011 Alejandro Liu Ly <alejandro_liu@hotmail.com>
+ * All Rights Reserved
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * The other end of a "vnet:PATH" interface (see netopen).  Frames are
+ * datagrams on an AF_UNIX socket bound to PATH and every peer is a
+ * port.  The hub learns which addresses live behind which port from
+ * the source of the frames it sees, sends unicast frames to the port
+ * that owns the destination and floods everything else.
+ *
+ * A peer announces itself with an empty datagram so it can be reached
+ * before it has sent anything.  Frames for a peer whose socket is full
+ * are dropped, like a switch would, rather than blocking the hub.
+ */
+#include "cec.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+extern int debug;
+
+enum {
+  VHUB_PORTS = 64,
+  VHUB_MACS = 256,
+};
+
+struct vhub_port {
+  struct sockaddr_un sa;
+  socklen_t salen;		/* 0 if the slot is free */
+};
+
+struct vhub_mac {
+  uchar ea[6];
+  int port;
+};
+
+static struct vhub_port ports[VHUB_PORTS];
+static struct vhub_mac macs[VHUB_MACS];
+static int nmacs;
+
+struct vhub_stats vhub_stats;
+
+/*
+ * Create the hub socket.  A stale socket left behind by a previous
+ * hub is removed.
+ */
+int vhub_open(char *path) {
+  struct sockaddr_un sa;
+  int fd;
+
+  if (strlen(path) >= sizeof sa.sun_path) {
+    fprintf(stderr,"%s: path too long\n",path);
+    return -1;
+  }
+  fd = socket(AF_UNIX,SOCK_DGRAM,0);
+  if (fd == -1) {
+    perror("vhub socket");
+    return -1;
+  }
+  memset(&sa,0,sizeof sa);
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path,path);
+  unlink(path);
+  if (bind(fd,(struct sockaddr *)&sa,sizeof sa) == -1) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  memset(ports,0,sizeof ports);
+  nmacs = 0;
+  memset(&vhub_stats,0,sizeof vhub_stats);
+  return fd;
+}
+
+static int vhub_port(struct sockaddr_un *sa, socklen_t salen) {
+  int i, free = -1;
+
+  for (i = 0; i < VHUB_PORTS; i++) {
+    if (!ports[i].salen) {
+      if (free == -1) free = i;
+      continue;
+    }
+    if (ports[i].salen == salen && memcmp(&ports[i].sa,sa,salen) == 0)
+      return i;
+  }
+  if (free == -1) return -1;
+  memcpy(&ports[free].sa,sa,salen);
+  ports[free].salen = salen;
+  if (debug) fprintf(stderr,"vhub: port %d is %s\r\n",free,sa->sun_path+1);
+  return free;
+}
+
+static void vhub_learn(uchar *ea, int port) {
+  int i;
+
+  if (ea[0] & 1) return;
+  for (i = 0; i < nmacs; i++) {
+    if (memcmp(macs[i].ea,ea,6) == 0) {
+      macs[i].port = port;
+      return;
+    }
+  }
+  if (nmacs == VHUB_MACS) {
+    /* Forget the oldest one, it will be flooded until seen again */
+    memmove(macs,macs+1,sizeof macs[0] * --nmacs);
+  }
+  memcpy(macs[nmacs].ea,ea,6);
+  macs[nmacs++].port = port;
+}
+
+static void vhub_drop(int port) {
+  int i, j;
+
+  if (debug) fprintf(stderr,"vhub: port %d gone\r\n",port);
+  ports[port].salen = 0;
+  for (i = j = 0; i < nmacs; i++) {
+    if (macs[i].port != port) macs[j++] = macs[i];
+  }
+  nmacs = j;
+}
+
+static void vhub_send(int fd, int port, void *buf, int len) {
+  struct vhub_port *p = &ports[port];
+
+  if (sendto(fd,buf,len,MSG_DONTWAIT,(struct sockaddr *)&p->sa,p->salen) == len) {
+    vhub_stats.frames_out++;
+    return;
+  }
+  if (errno == EAGAIN || errno == ENOBUFS) {
+    vhub_stats.drops++;
+    return;
+  }
+  vhub_drop(port);
+}
+
+/*
+ * Read one frame from the hub socket and forward it.  Returns the
+ * frame length, or -1 on error.
+ */
+int vhub_input(int fd) {
+  char buf[1514];
+  struct sockaddr_un sa;
+  socklen_t salen = sizeof sa;
+  int n, i, from;
+
+  n = recvfrom(fd,buf,sizeof buf,0,(struct sockaddr *)&sa,&salen);
+  if (n == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  if (salen <= sizeof sa.sun_family) return n;	/* unbound sender */
+  from = vhub_port(&sa,salen);
+  if (from == -1 || n < 14) return n;
+  vhub_stats.frames_in++;
+  vhub_learn((uchar *)buf+6,from);
+
+  if (!(buf[0] & 1)) {
+    for (i = 0; i < nmacs; i++) {
+      if (memcmp(macs[i].ea,buf,6) == 0) {
+	if (macs[i].port != from) vhub_send(fd,macs[i].port,buf,n);
+	return n;
+      }
+    }
+  }
+  for (i = 0; i < VHUB_PORTS; i++) {
+    if (i == from || !ports[i].salen) continue;
+    vhub_send(fd,i,buf,n);
+  }
+  return n;
+}